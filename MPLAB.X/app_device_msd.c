@@ -44,7 +44,10 @@ LUN_FUNCTIONS LUN[MAX_LUN + 1] =
         (uint8_t  (*)(void *, uint32_t, uint8_t*, uint8_t))&DIRECT_SectorRead,
         (uint8_t  (*)(void *))&DIRECT_WriteProtectStateGet,
         (uint8_t  (*)(void *, uint32_t, uint8_t*, uint8_t))&DIRECT_SectorWrite,
-        (void *)NULL
+        (void *)NULL,
+        NULL,
+        NULL,
+        (uint8_t  (*)(void *, uint32_t, uint8_t))&DIRECT_SegmentBlank
     }
 };
 
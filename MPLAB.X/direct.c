@@ -31,7 +31,25 @@ limitations under the License.
  * Global Variables
  *****************************************************************************/
 static FILEIO_MEDIA_INFORMATION mediaInformation;
-bool ParseHex(char c);
+static uint16_t quiet;      // ms since the last sector write 
+#if DIRECT_READBACK
+static uint16_t rb_quiet;   // ms since the last readback segment 
+static bool     rb_open;    // flag: target held in programming mode for readback
+static uint8_t  rb_line[ READBACK_RECORD];  // READ.HEX record formatted
+static uint16_t rb_index = 0xffff;          // record in rb_line (0xffff = none)
+#endif
+extern HEX_PARSER parser;
+bool fileWrite( HEX_PARSER *p, uint32_t sector_addr, uint8_t *buffer, uint8_t seg);
+void xpzInit( HEX_PARSER *p);
+void imageAbort( HEX_PARSER *p);
+uint8_t orderLocate( uint32_t *sector_addr);
+void orderNext( void);
+void holdPut( uint8_t *buffer, uint8_t seg);
+void sectorParse( uint32_t sector_addr, uint8_t *buffer, uint8_t seg);
+void orderInit( void);
+void orderFlush( void);
+
+enum ordermode { ORDER_PARSE, ORDER_NEXT, ORDER_SKIP, ORDER_HOLD};
 
 /******************************************************************************
  * Function:        uint8_t MediaDetect(void* config)
@@ -118,15 +136,39 @@ uint8_t DIRECT_SectorRead(void* config, uint32_t sector_addr, uint8_t* buffer, u
     else {
         memset(buffer, '\0', MSD_IN_EP_SIZE); // empty buffer
         if ( 4 == sector_addr) {        // Service README.HTM
-            if ( seg < ( (readme_size() + 63) % 64) ) 
+            if ( seg < ( (readme_size() + 63) / 64) ) 
                 strncpy( (void*)buffer, 
                          (void*)&readme[seg*64], 
                          64);  // at most 64 bytes at a time
         }
+        else if ( CLUSTER_SECTOR( VERIFY_CLUSTER) == sector_addr) 
+            DIRECT_ReportGet( buffer, seg);
+#if DIRECT_READBACK
+        else 
+            DIRECT_ReadbackGet( sector_addr, buffer, seg);
+#endif
     }
 	return true;
 }//end SectorRead
 
+/******************************************************************************
+ * Function:   uint8_t SegmentBlank(uint32_t sector_addr, seg)
+ * Input:      sector_addr - Sector address, each sector contains 512-byte
+ *             seg         - 64-byte segment of a sector
+ * Output:     Returns true if the segment reads as all zeros (most of the 
+ *             volume), SectorRead is then not called
+ *****************************************************************************/
+uint8_t DIRECT_SegmentBlank(void* config, uint32_t sector_addr, uint8_t seg)
+{
+    if      ( 0 == sector_addr)     return (seg < 6);   // (partition table)
+    else if ( 1 == sector_addr)     return (seg > 0) && (seg < 7);
+    else if ( 2 == sector_addr)     return false;       // FAT
+    else if ( 3 == sector_addr)     return (seg >= ROOT_SEGMENTS);
+    else if ( 4 == sector_addr)     return (seg >= ( (readme_size() + 63) / 64) );
+    // report and readback files, at the end of the volume
+    return (sector_addr < CLUSTER_SECTOR( VERIFY_CLUSTER));
+}
+
 /******************************************************************************
  * Function:        uint8_t SectorWrite(uint32_t sector_addr, uint8_t *buffer, uint8_t seg)
  * Input:           sector_addr - Sector address, each sector contains 512-byte
@@ -136,10 +178,14 @@ uint8_t DIRECT_SectorRead(void* config, uint32_t sector_addr, uint8_t* buffer, u
  *****************************************************************************/
 uint8_t DIRECT_SectorWrite(void* config, uint32_t sector_addr, uint8_t* buffer, uint8_t seg)
 {
+    static uint8_t  mode;       // enum ordermode (of the sector being received)
+    static uint32_t sector;     // (logical) sector address
+
     if (( sector_addr < 2) ||(sector_addr >= DRV_FILEIO_INTERNAL_FLASH_TOTAL_DISK_SIZE))
     {
         return false;
     }  
+    quiet = 0;
     if ( 2 == sector_addr) {            // updating the FAT table - RAM
         FATRecordSet( buffer, seg);     // update the RAM (fabricated) image 
         return true;
@@ -149,13 +195,37 @@ uint8_t DIRECT_SectorWrite(void* config, uint32_t sector_addr, uint8_t* buffer,
         return true;
     }
 
-    // all remaining data sectors are parsed and programmed directly into the device
-    uint16_t i=0;
-    while( (i++ < 64) && ParseHex(*buffer++));
-    
+    // sectors located in the FAT chains: other files are dropped, images 
+    // are taken in file order
+    if (seg == 0) {
+        sector = sector_addr;
+        mode = orderLocate( &sector);
+    }
+    if (mode == ORDER_SKIP) 
+        return true;
+    if (mode == ORDER_HOLD) {
+        holdPut( buffer, seg);
+        return true;
+    }
+    sectorParse( sector, buffer, seg);
+    if ((mode == ORDER_NEXT) && (seg == (FILEIO_CONFIG_MEDIA_SECTOR_SIZE / MSD_OUT_EP_SIZE) - 1))
+        orderNext();
     return true;
 } // SectorWrite
 
+/**
+ * Parse a segment of a data sector
+ */
+void sectorParse( uint32_t sector_addr, uint8_t *buffer, uint8_t seg)
+{
+    // raw binary and compressed images bypass the hex parser
+    if ( fileWrite( &parser, sector_addr, buffer, seg)) 
+        return;
+
+    // all remaining data sectors are parsed and programmed directly into the device
+    ParseHexBlock( &parser, buffer, MSD_OUT_EP_SIZE);
+}
+
 /******************************************************************************
  * Function:        uint8_t WriteProtectState(void)
  * Output:          uint8_t    - Returns always false (never protected)
@@ -170,28 +240,514 @@ uint8_t DIRECT_WriteProtectStateGet(void* config)
  
  This is a simple state machine that parses an input stream to detect and decode
  the INTEL Hex file format produced by the MPLAB XC8 compiler
- Bytes are assembled in Words 
- Words are assembled in Rows (currently supporting fixed size of 32-words)
+ Bytes are streamed straight into the row buffer as they are decoded (no staging)
+ Words are assembled in Rows of ROW_SIZE words, split in device rows (as read 
+ from the target, see LVP_deviceGet) when programmed
  Rows are aligned (normalized) and written directly to the target using LVP ICSP
  Special treatment is reserved for words written to 'configuration' addresses 
+
+ All the state of a stream is kept in a HEX_PARSER context, passed explicitly 
+ to the parse, pack and flush functions, so that several streams can coexist
+ ******************************************************************************/
+#define CFG_ADDRESS LVP_CFG_SPACE   // for all pic16f1xxx
+#define WORD_MASK   0x3fff   // 14-bit program words, erased value 0x3fff
+
+#define ROW_EMPTY   0xffffffff  // address of an unused cache slot
+
+// the MSD stream context
+HEX_PARSER parser;
+
+/*******************************************************************************
+ Replay Suppression
+ 
+ Hosts often write the same file data again (on close, on a metadata update, 
+ after a delayed write-back). Each programming session (the rows flushed up to
+ the end of file) is fingerprinted with a chained CRC-16, one tag per row for 
+ the first DIRECT_REPLAY_ROWS rows and one for the whole session, and 
+ compared against the record of the last successful session:
+ - as long as rows match the record nothing is sent to the target, so that an 
+   identical stream ends without ever entering programming mode. Rows past 
+   the tags are read back from the target instead (no erase or programming)
+   and the session must end with the same row count and CRC
+ - at the first mismatch the target is entered without a bulk erase (patch), 
+   every following row is erased and programmed individually and rows left 
+   over from the previous image are erased at the end of the session
+ - config bits can only be set again by a bulk erase, a patch requiring one
+   erases the target and aborts the image, to be copied again (see cfgFail)
+ The record assumes the target is not reprogrammed by other means in between.
+ Without a record (power up, S1) the session is differential: each row is 
+ read back from the target and compared, only the rows that differ are erased
+ and programmed and non blank rows outside the image are erased at the end
  ******************************************************************************/
-#define ROW_SIZE     32      // for all pic16f188xx
-#define CFG_ADDRESS 0x8000   // for all pic16f188xx
-#define CFG_NUM      5       // number of config words for PIC16F188xx
+enum replaymode { REPLAY_CHECK, REPLAY_PATCH, REPLAY_FULL, REPLAY_DIFF};
+
+typedef struct {
+    uint16_t tag[ DIRECT_REPLAY_ROWS];  // chained CRC after each row 
+    uint8_t  map[ DIRECT_REPLAY_MAP];   // rows programmed (bit per row)
+    uint16_t cfg[ LVP_CFG_MAX];         // config words programmed
+    uint16_t rows;                      // number of rows in the session
+    uint16_t crc;                       // chained CRC of the whole session
+    bool     cfg_set;                   
+    bool     valid;                     
+} REPLAY_RECORD;
+
+static REPLAY_RECORD record;    // last successful session (target contents)
+
+/**
+ * CRC-16 CCITT, byte at a time (no table)
+ */
+uint16_t crcUpdate( uint16_t crc, const uint8_t *data, uint8_t n) {
+    while( n-- > 0) {
+        crc = (crc >> 8) | (crc << 8);
+        crc ^= *data++;
+        crc ^= (crc & 0xff) >> 4;
+        crc ^= crc << 12;
+        crc ^= (crc & 0xff) << 5;
+    }
+    return crc;
+}
+
+/**
+ * Start a new session (previous record kept for comparison)
+ */
+void replayInit( HEX_PARSER *p) {
+    p->replay_mode = REPLAY_CHECK;
+    p->replay_rows = 0;
+    p->replay_crc = 0xffff;
+    p->replay_keep = true;
+    memset( (void*)p->replay_map, 0, sizeof(p->replay_map));
+    memset( (void*)p->replay_skip, 0, sizeof(p->replay_skip));
+}
+
+/**
+ * Mark a row in the map of the current session
+ * @return  true if the row still holds data of the previous image (the first 
+ *          time it is written in the session) 
+ */
+bool replayMark( HEX_PARSER *p, uint32_t address) {
+    uint16_t r = address / ROW_SIZE;
+    uint8_t  bit = 1 << (r & 7);
+    bool     stale;
+
+    if (address >= DIRECT_REPLAY_FLASH) {   // the session cannot be recorded
+        p->replay_keep = false;
+        return false;       // (rows outside the map are blank in the record)
+    }
+    stale = ((record.map[ r >> 3] & ~p->replay_map[ r >> 3] & bit) != 0);
+    p->replay_map[ r >> 3] |= bit;
+    return stale;
+}
+
+/**
+ * Compare a target row with the one to be programmed 
+ * @return  ROW_SAME, ROW_BLANK (differs, target row erased) or ROW_DIFFERENT
+ */
+enum rowcompare { ROW_SAME, ROW_BLANK, ROW_DIFFERENT};
+
+uint8_t rowCompare( const uint16_t *data, uint16_t address, uint8_t n) {
+    uint8_t i;
+    uint16_t w;
+    bool same = true, blank = true;
+
+    LVP_addressLoad( address);
+    for( i=0; i<n; i++) {
+        w = LVP_readNext() & WORD_MASK;
+        if (w != (*data++ & WORD_MASK)) same = false;
+        if (w != WORD_MASK) blank = false;
+    }
+    if (same) return ROW_SAME;
+    return blank ? ROW_BLANK : ROW_DIFFERENT;
+}
+
+/**
+ * Enter programming mode for the session (once)
+ */
+void targetEnter( HEX_PARSER *p) {
+    if (p->lvp) return;
+    p->lvp = true;
+    LVP_enter();
+    p->stats.socketsFailed = LVP_GANG_MASK & ~LVP_calibrationGet()->sockets;
+}
+
+/**
+ * Check a row past the tags of the record (DIRECT_REPLAY_ROWS): program 
+ * memory rows are compared with the target, config words with the record
+ * @return  true if the target has it already
+ */
+bool replaySame( HEX_PARSER *p, DIRECT_ROW *slot, bool cfg) {
+    const LVP_DEVICE *dev = LVP_deviceGet();
+    if (cfg) 
+        return record.cfg_set && (memcmp( (void*)record.cfg, 
+                (void*)&slot->data[ dev->cfg_address - CFG_ADDRESS], dev->cfg_num * 2) == 0);
+    targetEnter( p);
+    return rowCompare( slot->data, slot->address, ROW_SIZE) == ROW_SAME;
+}
+
+/**
+ * Test a target row for blank (stops at the first programmed word)
+ */
+bool rowBlank( uint16_t address, uint8_t n) {
+    uint8_t i;
+    LVP_addressLoad( address);
+    for( i=0; i<n; i++) 
+        if ((LVP_readNext() & WORD_MASK) != WORD_MASK) return false;
+    return true;
+}
+
+/**
+ * Update the config words of a target that was not bulk erased, bits can 
+ * only be cleared: only the implemented bits (device cfg_mask) are compared
+ * @return  false if an implemented bit must be set (bulk erase required) or 
+ *          the words read back do not match
+ */
+bool cfgUpdate( uint16_t *cfg) {
+    const LVP_DEVICE *dev = LVP_deviceGet();
+    uint16_t old, mask;
+    uint8_t i;
+    bool change = false;
+
+    for( i=0; i<dev->cfg_num; i++) {
+        old = LVP_read( dev->cfg_address + i);
+        mask = dev->cfg_mask[i];
+        if (~old & cfg[i] & mask) return false;
+        if (old & ~cfg[i] & mask) change = true;
+    }
+    if (!change) return true;       // unchanged
+    LVP_cfgWrite( cfg, dev->cfg_num);
+    for( i=0; i<dev->cfg_num; i++) 
+        if ((LVP_read( dev->cfg_address + i) ^ cfg[i]) & dev->cfg_mask[i]) 
+            return false;
+    return true;
+}
+
+/**
+ * Config words that cannot be updated without a bulk erase: the rows of the 
+ * session have been programmed already and cannot be received again, the 
+ * target is bulk erased (rather than left running with the old config words) 
+ * and the image is aborted, to be copied again
+ * @param p         context 
+ */
+void cfgFail( HEX_PARSER *p) {
+    p->stats.replayErrors++;
+    p->verify_count = 0;        // (rows erased, not read back)
+    LVP_bulkErase();
+    imageAbort( p);
+}
+
+/**
+ * Device row size, in steps of which the rows are programmed
+ */
+uint8_t rowStep( void) {
+    uint8_t n = LVP_deviceGet()->row_size;
+    return (n < ROW_SIZE) ? n : ROW_SIZE;
+}
+
+/**
+ * Test if rows can be erased individually (patch/differential programming) 
+ */
+bool rowErasable( void) {
+    const LVP_DEVICE *dev = LVP_deviceGet();
+    // (gang: only the reference socket is read, the targets could differ)
+    return (LVP_GANG_MASK == ICSP_DAT_MASK) && 
+            dev->row_erase && (dev->row_size <= ROW_SIZE);
+}
+
+/**
+ * Test if the target can be programmed differentially: the session map must 
+ * cover the whole program memory (rows written twice, rows left over)
+ */
+bool diffPossible( void) {
+    return rowErasable() && (LVP_deviceGet()->flash_size <= DIRECT_REPLAY_FLASH);
+}
 
-// internal state
-uint16_t row[ ROW_SIZE];    // buffer containing row being formed
-uint32_t row_address;       // destination address of current row 
-bool     lvp;               // flag: low voltage programming in progress
+/**
+ * Erase all the device rows of a row
+ */
+void rowErase( uint16_t address) {
+    uint8_t a, step = rowStep();
+    for( a=0; a<ROW_SIZE; a+=step) 
+        LVP_rowErase( address + a);
+}
+
+/**
+ * End of session, erase rows left over from the previous image and update 
+ * the record
+ */
+void replayEnd( HEX_PARSER *p) {
+    uint16_t r;
+
+    if (p->replay_mode == REPLAY_CHECK) {
+        if (record.valid && (p->replay_rows == record.rows) && (p->replay_rows > 0)
+                && (p->replay_crc == record.crc)) {
+            p->stats.replays++;     // identical stream, nothing to do 
+            return;
+        }
+        if (p->replay_rows == 0) return;
+        // a shorter stream, all rows matching so far
+        p->replay_mode = REPLAY_PATCH;
+        p->stats.patches++;
+        targetEnter( p);
+    }
+    // (a patch failing on the config words was aborted, see cfgFail)
+    if (p->replay_mode == REPLAY_PATCH) {
+        for( r=0; r < (DIRECT_REPLAY_FLASH / ROW_SIZE); r++) {
+            if ((record.map[ r >> 3] & ~p->replay_map[ r >> 3] & (1 << (r & 7))) != 0)
+                rowErase( r * ROW_SIZE);
+        }
+    }
+    if (p->replay_mode == REPLAY_DIFF) {     // contents unknown, scan
+        uint16_t a, end = LVP_deviceGet()->flash_size;
+        uint8_t step = rowStep();
+        for( a=0; a < end; a+=step) {
+            r = a / ROW_SIZE;
+            if (((p->replay_map[ r >> 3] & (1 << (r & 7))) == 0) && !rowBlank( a, step))
+                LVP_rowErase( a);
+        }
+    }
+    memcpy( (void*)record.map, (void*)p->replay_map, sizeof(record.map));
+    record.rows = p->replay_rows;
+    record.crc = p->replay_crc;
+    // (skipping rows of a device that cannot be patched would lose them)
+    record.valid = p->replay_keep && rowErasable();
+}
+
+/*******************************************************************************
+ Read-after-Write Verification
+ 
+ Each row programmed is read back (read with post-increment) as soon as its 
+ programming cycle is over, from DIRECT_Tasks while the host keeps sending 
+ or at the latest before the next row is latched. The readback is compared 
+ against a CRC of the words latched, so no copy of the row is kept. 
+ The 6-bit family has no command loading the PC: moving back to a row just 
+ programmed is a reset and increments from 0. Its rows are kept pending (up
+ to DIRECT_VERIFY_ROWS) and read in one pass, when the target has to move 
+ back anyway (a row compared or a new pass over the image) or the list is 
+ full. 
+ Config words are not verified (unimplemented bits read back as 0)
+ ******************************************************************************/
+static bool verify = DIRECT_VERIFY;
+
+/**
+ * Enable/disable the verification of the rows programmed
+ */
+void DIRECT_VerifySet( bool on) {
+    verify = on;
+}
+
+/**
+ * CRC of a span of program words (as latched)
+ */
+uint16_t wordsCrc( const uint16_t *data, uint8_t n) {
+    uint16_t crc = 0xffff, w;
+    while( n-- > 0) {
+        w = *data++ & WORD_MASK;
+        crc = crcUpdate( crc, (const uint8_t*)&w, 2);
+    }
+    return crc;
+}
+
+/**
+ * Read back the rows programmed below an address (lowest address first), 
+ * waits for the end of the last programming cycle 
+ * @param p             context 
+ * @param limit         first address left pending (0xffff: all the rows)
+ */
+void verifyRows( HEX_PARSER *p, uint16_t limit) {
+    DIRECT_VERIFY_ROW *v;
+    uint16_t crc, w;
+    uint8_t i, k;
+
+    uint8_t failed;
+
+    while( p->verify_count > 0) {
+        for( k=0, i=1; i<p->verify_count; i++)
+            if (p->verify[i].address < p->verify[k].address) k = i;
+        v = &p->verify[k];
+        if (v->address >= limit) break;
+        LVP_addressLoad( v->address);
+        LVP_mismatchGet();
+        crc = 0xffff;
+        for( i=0; i<v->n; i++) {
+            w = LVP_readNext() & WORD_MASK;
+            crc = crcUpdate( crc, (const uint8_t*)&w, 2);
+        }
+        p->stats.rowsVerified++;
+        // (gang) sockets differing from a good reference have failed, when the
+        // reference has failed the others cannot be told apart: all failed
+        failed = LVP_mismatchGet();
+        if (crc != v->expect) 
+            failed = LVP_GANG_MASK;
+        if (failed) {
+            p->stats.verifyErrors++;
+            p->stats.socketsFailed |= failed;
+            p->replay_keep = false;     // target contents unknown, no replay
+        }
+        p->verify_crc = crcUpdate( p->verify_crc, (const uint8_t*)&crc, 2);
+        *v = p->verify[ --p->verify_count];
+    }
+}
+
+/**
+ * Read back the rows pending before the target PC moves to an address: all 
+ * of them when the PC can be loaded, otherwise (6-bit family) only the rows 
+ * on the way back to the address, or all of them once the list is full
+ * @param p             context 
+ * @param address       next address accessed (0xffff: none)
+ */
+void verifyDue( HEX_PARSER *p, uint16_t address) {
+    if (p->verify_count == 0) return;
+    if (LVP_seekBack( address))         // moving back anyway
+        verifyRows( p, address);
+    if (p->verify_count == 0) return;
+    if ((p->verify_count == DIRECT_VERIFY_ROWS) || !LVP_seekBack( p->verify[0].address))
+        verifyRows( p, 0xffff);
+}
+
+/*******************************************************************************
+ Verify-Only Sessions
+ 
+ A session announced by the control file DIRECT_VERIFY_FILE (see files.c) 
+ runs the same parse/pack stream, but the rows flushed are compared with the 
+ target instead of being programmed: nothing is erased or written and the 
+ replay record is left as it was. The outcome (rows compared, rows differing
+ and their addresses) is published in VERIFY.TXT. As for the read-after-write
+ verification, config words are not compared
+ ******************************************************************************/
+enum verifystate { VERIFY_NONE, VERIFY_ARMED, VERIFY_RUNNING, VERIFY_DONE};
+
+typedef struct {
+    uint8_t  state;             // enum verifystate
+    bool     stopped;           // flag: rows left uncompared (DIRECT_VERIFY_STOP)
+    uint16_t rows;              // rows compared
+    uint16_t mismatches;        // rows differing
+    uint16_t list[ DIRECT_VERIFY_LIST];  // (word) address of the first ones
+} VERIFY_REPORT;
+
+static VERIFY_REPORT report;
+
+/**
+ * Make the next session verify-only (ignored once rows have been programmed)
+ */
+void DIRECT_VerifyOnly( void) {
+    if (parser.session || parser.lvp || (parser.replay_rows > 0)) return;
+    memset( (void*)&report, 0, sizeof(report));
+    report.state = VERIFY_ARMED;
+    parser.write = lvpVerify;
+}
+
+/**
+ * Compare a row with the target (row handler of verify-only sessions)
+ * @param p         context 
+ * @param slot      row to be compared
+ * @param first     index of the first non-blank word
+ * @param n         number of words to compare
+ */
+void lvpVerify( HEX_PARSER *p, DIRECT_ROW *slot, uint8_t first, uint8_t n) {
+    uint8_t failed;
+
+    if ((slot->address >= CFG_ADDRESS) || report.stopped) return;
+    if (!p->lvp) {
+        p->lvp = true;
+        LVP_enter();
+        p->stats.socketsFailed = LVP_GANG_MASK & ~LVP_calibrationGet()->sockets;
+        report.state = VERIFY_RUNNING;
+    }
+    report.rows++;
+    LVP_mismatchGet();
+    failed = (rowCompare( &slot->data[ first], slot->address + first, n) == ROW_SAME) ? 
+            LVP_mismatchGet() : LVP_GANG_MASK;
+    if (!failed) return;
+    p->stats.socketsFailed |= failed;
+    if (report.mismatches < DIRECT_VERIFY_LIST) 
+        report.list[ report.mismatches] = slot->address;
+    report.mismatches++;
+    report.stopped = DIRECT_VERIFY_STOP;
+}
+
+static uint8_t *hexPut( uint8_t *s, uint8_t b) {
+    static const char digits[] = "0123456789ABCDEF";
+    *s++ = digits[ b >> 4];
+    *s++ = digits[ b & 0xf];
+    return s;
+}
+
+/**
+ * Right align a decimal number in a 5 character field
+ */
+static void decPut( uint8_t *s, uint16_t v) {
+    uint8_t i = 5;
+    do {
+        s[ --i] = '0' + (v % 10);
+        v /= 10;
+    } while( (v > 0) && (i > 0));
+}
+
+/**
+ * Format a line of VERIFY.TXT (14 characters + CRLF)
+ */
+static void reportLine( uint8_t *s, uint8_t line) {
+    uint8_t i = line - 4;
+    memset( (void*)s, ' ', VERIFY_LINE - 2);
+    s[ VERIFY_LINE - 2] = '\r';
+    s[ VERIFY_LINE - 1] = '\n';
+    switch( line) {
+        case 0:
+            memcpy( (void*)s, (const void*)"result", 6);
+            if (report.state == VERIFY_NONE) 
+                memcpy( (void*)&s[ 10], (const void*)"none", 4);
+            else if (report.state != VERIFY_DONE) 
+                memcpy( (void*)&s[ 10], (const void*)"busy", 4);
+            else 
+                memcpy( (void*)&s[ 10], (report.mismatches) ? "FAIL" : "PASS", 4);
+            break;
+        case 1:
+            memcpy( (void*)s, (const void*)"rows", 4);
+            decPut( &s[ 9], report.rows);
+            break;
+        case 2:
+            memcpy( (void*)s, (const void*)"mismatch", 8);
+            decPut( &s[ 9], report.mismatches);
+            break;
+        case 3:
+            memcpy( (void*)s, (const void*)"stopped", 7);
+            memcpy( (void*)&s[ 11], (report.stopped) ? "yes" : " no", 3);
+            break;
+        default:    // rows differing 
+            if ((i < DIRECT_VERIFY_LIST) && (i < report.mismatches)) {
+                memcpy( (void*)s, (const void*)"row", 3);
+                hexPut( hexPut( &s[ 10], (uint8_t)(report.list[ i] >> 8)), 
+                        (uint8_t)report.list[ i]);
+            }
+            break;
+    }
+}
+
+void DIRECT_ReportGet( uint8_t *buffer, uint8_t seg) {
+    uint8_t i, line = seg * (MSD_IN_EP_SIZE / VERIFY_LINE);
+    for( i=0; i<MSD_IN_EP_SIZE; i+=VERIFY_LINE) 
+        reportLine( &buffer[ i], line++);
+}
+
+/**
+ * LVP completion callback (end of a programming/erase cycle)
+ */
+static void lvpDone( void) {
+    parser.stats.cycles++;
+}
 
 /** 
  * State machine initialization
  */
 void DIRECT_Initialize( void) {
-    memset((void*)row, 0xff, sizeof(row));    // fill buffer with blanks
-    row_address = 0x8000;
-    lvp = false;
+    record.valid = false;
+#if DIRECT_READBACK
+    rb_open = false;
+#endif
+    report.state = VERIFY_NONE;
+    orderInit();
+    HEX_ParserInit( &parser, lvpWrite);
     LVP_init();
+    LVP_callbackSet( lvpDone);
 }
 
 /**
@@ -199,207 +755,1062 @@ void DIRECT_Initialize( void) {
  * @return  true if lvp sequence in progress
  */
 bool DIRECT_ProgrammingInProgress( void) {
-    return lvp;
+#if DIRECT_READBACK
+    if (rb_open) return true;
+#endif
+    return parser.lvp || (parser.queue_count > 0) || LVP_busy();
 }
 
-bool isDigit( char * c){
-    if (*c < '0') return false;
-    *c -= '0'; if (*c > 9) *c-=7;
-    if (*c > 0xf)  return false;
-    return true;
+/**
+ * Access the programming statistics (for tuning)
+ * @return  pointer to the statistics counters 
+ */
+const DIRECT_STATISTICS * DIRECT_StatisticsGet( void) {
+    return &parser.stats;
 }
-    
-void lvpWrite( void){
-    // check for first entry in lvp 
-    if (!lvp) {
-        lvp = true;
-        LVP_enter();
-        LVP_bulkErase();
+
+/**
+ * Empty the row cache (contents are discarded)
+ */
+void cacheInit( HEX_PARSER *p) {
+    uint8_t i;
+    for( i=0; i<DIRECT_CACHE_ROWS; i++) {
+        memset((void*)p->cache[i].data, 0xff, sizeof(p->cache[i].data));   // fill buffer with blanks
+        p->cache[i].address = ROW_EMPTY;
+    }
+    p->slot = p->cache;
+    p->row = p->cache[0].data;
+    p->row_address = ROW_EMPTY;
+    p->row_index = 0;
+}
+
+/**
+ * Abort the image being received (corrupt record, sector missing): the cached
+ * rows are dropped, the data that follows is ignored until the session closes
+ * (end of file or quiet host) and the session is not recorded, nor are the 
+ * rows of the previous image left over erased
+ */
+void imageAbort( HEX_PARSER *p) {
+    if (p->corrupt) return;
+    p->corrupt = true;
+    p->replay_keep = false;
+    cacheInit( p);
+}
+
+/**
+ * Stream context initialization
+ * @param p         context 
+ * @param write     handler receiving each (non-blank) row
+ */
+void HEX_ParserInit( HEX_PARSER *p, DIRECT_ROW_HANDLER write) {
+    memset((void*)p, 0, sizeof(HEX_PARSER));
+    cacheInit( p);
+    replayInit( p);
+    p->write = write;
+    p->state = SOL;
+    p->format = FORMAT_HEX;
+    p->verify_crc = 0xffff;
+    p->stats.parserSize = sizeof(HEX_PARSER);
+}
+
+/**
+ * Program the part of a row held by a device row
+ * @param p         context 
+ * @param slot      row to be programmed
+ * @param a         index of the device row 
+ * @param step      device row size
+ * @param first     index of the first non-blank word (of the row)
+ * @param end       index past the last non-blank word (of the row)
+ * @param compare   compare the device row with the target first (words not
+ *                  received yet are taken as blank)
+ */
+void deviceRowWrite( HEX_PARSER *p, DIRECT_ROW *slot, uint8_t a, uint8_t step, 
+                     uint8_t first, uint8_t end, bool compare) {
+    uint8_t s = (first > a) ? first : a;
+    uint8_t e = (end < a + step) ? end : a + step;
+    DIRECT_VERIFY_ROW *v;
+
+    while( (s < e) && ((slot->data[s] & WORD_MASK) == WORD_MASK)) s++;
+    while( (e > s) && ((slot->data[e-1] & WORD_MASK) == WORD_MASK)) e--;
+    verifyDue( p, slot->address + a);
+    if (compare) {
+        switch( rowCompare( &slot->data[a], slot->address + a, step)) {
+            case ROW_SAME:
+                p->stats.rowsSkipped++;     // the target has it already
+                return;
+            case ROW_DIFFERENT:
+                LVP_rowErase( slot->address + a);
+                break;
+            default:
+                break;
+        }
+    }
+    if (s >= e) return;         // blank
+    verifyDue( p, slot->address + s);   // rows programmed before first
+    LVP_addressLoad( slot->address + s);
+    LVP_rowWrite( &slot->data[ s], e - s);
+    if (verify) {   // read back later, once programmed (room left by verifyDue)
+        v = &p->verify[ p->verify_count++];
+        v->address = slot->address + s;
+        v->n = e - s;
+        v->expect = wordsCrc( &slot->data[ s], e - s);
+    }
+}
+
+/**
+ * Program a row 
+ * @param p         context 
+ * @param slot      row to be programmed
+ * @param first     index of the first non-blank word
+ * @param n         number of words to latch (up to the last non-blank one)
+ */
+void lvpWrite( HEX_PARSER *p, DIRECT_ROW *slot, uint8_t first, uint8_t n){
+    uint16_t k = p->replay_rows++;
+    uint16_t r = slot->address / ROW_SIZE;
+    bool cfg = (slot->address >= CFG_ADDRESS);
+    bool stale = false, again = false, compare;
+    const LVP_DEVICE *dev;
+    uint16_t *cfg_words;
+    uint8_t a, step;
+
+    if (p->corrupt) return;     // rows still queued when the image was aborted
+    verifyDue( p, slot->address);       // rows programmed before first
+
+    p->replay_crc = crcUpdate( p->replay_crc, (const uint8_t*)&slot->address, 2);
+    p->replay_crc = crcUpdate( p->replay_crc, (const uint8_t*)slot->data, ROW_BYTES);
+    if (!cfg) {
+        again = (r < DIRECT_REPLAY_FLASH / ROW_SIZE) && (p->replay_map[ r >> 3] & (1 << (r & 7)));
+        stale = replayMark( p, slot->address);
+    }
+
+    if (p->replay_mode == REPLAY_CHECK) {
+        if (record.valid && (k < record.rows) && ((k < DIRECT_REPLAY_ROWS) 
+                ? (record.tag[k] == p->replay_crc) : replaySame( p, slot, cfg))) {
+            p->stats.rowsSkipped++;     // the target has it already
+            if (!cfg) p->replay_skip[ r >> 3] |= 1 << (r & 7);
+            return;
+        }
+        // first divergence, patch the previous image if there was one 
+        targetEnter( p);
+        if (record.valid && (k > 0)) {  // (valid only if rows can be erased)
+            record.valid = false;   // until the session is complete 
+            p->replay_mode = REPLAY_PATCH;
+            p->stats.patches++;
+        }
+        else {
+            if (DIRECT_DIFFERENTIAL && diffPossible()) {
+                p->replay_mode = REPLAY_DIFF;
+                p->stats.diffs++;
+            }
+            else {
+                p->replay_mode = REPLAY_FULL;
+                LVP_bulkErase();
+            }
+            record.cfg_set = false;
+        }
+    }
+    if (k < DIRECT_REPLAY_ROWS) 
+        record.tag[k] = p->replay_crc;
+
+    if (cfg) {    // use the special cfg word sequence
+        dev = LVP_deviceGet();
+        cfg_words = &slot->data[ dev->cfg_address - CFG_ADDRESS];
+        if ((p->replay_mode == REPLAY_PATCH) && record.cfg_set
+                && (memcmp( (void*)record.cfg, (void*)cfg_words, dev->cfg_num * 2) == 0))
+            return;     // unchanged
+        if (p->replay_mode == REPLAY_FULL) 
+            LVP_cfgWrite( cfg_words, dev->cfg_num);
+        else if (!cfgUpdate( cfg_words)) {
+            // config words cannot be erased without erasing everything
+            cfgFail( p);
+            return;
+        }
+        memcpy( (void*)record.cfg, (void*)cfg_words, dev->cfg_num * 2);
+        record.cfg_set = true;
+    }
+    else { // normal row programming sequence, latches outside the span are 
+           // left blank (they are reset after each programming cycle)
+        // rows past the tags of the record are compared in a patch as well
+        compare = !again && ((p->replay_mode == REPLAY_DIFF) ||
+                ((p->replay_mode == REPLAY_PATCH) && (k >= DIRECT_REPLAY_ROWS)));
+        if (p->replay_mode == REPLAY_PATCH) {
+            if (stale) {
+                if (!compare) rowErase( slot->address);
+            }
+            else if ((r < DIRECT_REPLAY_FLASH / ROW_SIZE) && (p->replay_skip[ r >> 3] & (1 << (r & 7)))) {
+                // part of the row was skipped, the rest of it cannot be 
+                // changed without losing it (records out of order)
+                p->stats.replayErrors++;
+                p->replay_keep = false;
+            }
+        }
+        // the first time in the session a differential row is compared with
+        // the target (later parts of the row go to blank words). A row split
+        // by an eviction is compared with blanks in place of the words still
+        // to come, so it is erased and programmed again even if unchanged 
+        // (hexopt keeps the rows whole)
+        step = rowStep();
+        for( a=0; a<ROW_SIZE; a+=step) 
+            deviceRowWrite( p, slot, a, step, first, first + n, compare);
+    }
+}
+
+/**
+ * Pass the oldest queued row to the row handler
+ * @param p             context 
+ */
+void queueDrain( HEX_PARSER *p) {
+    DIRECT_QUEUED *q = &p->queue[ p->queue_head];
+    p->write( p, &q->row, q->first, q->n);
+    if (++p->queue_head == DIRECT_QUEUE_ROWS) p->queue_head = 0;
+    p->queue_count--;
+}
+
+/**
+ * Program all the queued rows
+ * @param p             context 
+ */
+void queueFlush( HEX_PARSER *p) {
+    while( p->queue_count > 0) 
+        queueDrain( p);
+}
+
+/**
+ * Queue the row held by the free entry at the tail of the queue
+ * @param p             context 
+ * @param first         index of the first non-blank word
+ * @param n             number of words to latch
+ */
+void queueAppend( HEX_PARSER *p, uint8_t first, uint8_t n) {
+    uint8_t i = p->queue_head + p->queue_count;
+    if (i >= DIRECT_QUEUE_ROWS) i -= DIRECT_QUEUE_ROWS;
+    p->queue[ i].first = first;
+    p->queue[ i].n = n;
+    if (++p->queue_count > p->stats.queueHigh) 
+        p->stats.queueHigh = p->queue_count;
+}
+
+/**
+ * Queue a row for programming, when the queue is full the oldest row is 
+ * programmed first (holding the host until it is latched)
+ * @param p             context 
+ * @param slot          row to be programmed (copied)
+ * @param first         index of the first non-blank word
+ * @param n             number of words to latch
+ */
+void queuePut( HEX_PARSER *p, DIRECT_ROW *slot, uint8_t first, uint8_t n) {
+    DIRECT_QUEUED *q;
+    uint8_t i;
+    if (p->queue_count == DIRECT_QUEUE_ROWS) {
+        p->stats.queueFull++;
+        queueDrain( p);
     }
-    if (row_address >= CFG_ADDRESS) {    // use the special cfg word sequence
-        LVP_cfgWrite( &row[7], CFG_NUM);
+    i = p->queue_head + p->queue_count;
+    if (i >= DIRECT_QUEUE_ROWS) i -= DIRECT_QUEUE_ROWS;
+    q = &p->queue[ i];
+    memcpy( (void*)q->row.data, (void*)slot->data, sizeof(q->row.data));
+    q->row.address = slot->address;
+    queueAppend( p, first, n);
+}
+
+/**
+ * Span of the non-blank words of a row (according to the word width)
+ * @param slot          row
+ * @param first         index of the first non-blank word
+ * @return  number of words to latch (0 = blank row)
+ */
+uint8_t rowSpan( DIRECT_ROW *slot, uint8_t *first) {
+    uint8_t i, last = 0;
+    *first = ROW_SIZE;
+    for( i=0; i< ROW_SIZE; i++) {
+        if ((slot->data[i] & WORD_MASK) != WORD_MASK) {
+            if (*first == ROW_SIZE) *first = i;
+            last = i;
+        }
+    }
+    return (*first < ROW_SIZE) ? last - *first + 1 : 0;
+}
+
+void writeRow( HEX_PARSER *p, DIRECT_ROW *slot) {
+    // latch and program a row, skip if blank 
+    uint8_t first, n = rowSpan( slot, &first);
+    if (n > 0) { 
+        queuePut( p, slot, first, n);
+        memset((void*)slot->data, 0xff, sizeof(slot->data));    // fill buffer with blanks
+    }
+    slot->address = ROW_EMPTY;
+}
+
+/**
+ * Fast path: a row aligned full row record (see hexopt) defines the entire 
+ * row, it is received in the free entry at the tail of the queue and queued 
+ * as soon as its checksum is good, without cache lookup, eviction or copy 
+ * (programmed in the background, behind the rows queued before it)
+ * @param p             context 
+ * @param address       byte address (as found in the hex file)
+ */
+void rowDirect( HEX_PARSER *p, uint32_t address) {
+    uint32_t new_row = (address & 0xfffff) >> 1;
+    DIRECT_ROW *slot;
+    uint8_t i;
+
+    if (p->queue_count == DIRECT_QUEUE_ROWS) {
+        p->stats.queueFull++;
+        queueDrain( p);
     }
-    else { // normal row programming sequence
-        LVP_addressLoad( row_address);
-        LVP_rowWrite( row, ROW_SIZE);
+    for( i=0, slot=p->cache; i<DIRECT_CACHE_ROWS; i++, slot++) {
+        if (slot->address == new_row) {     // superseded by the record
+            memset((void*)slot->data, 0xff, sizeof(slot->data));
+            slot->address = ROW_EMPTY;
+        }
     }
+    i = p->queue_head + p->queue_count;
+    if (i >= DIRECT_QUEUE_ROWS) i -= DIRECT_QUEUE_ROWS;
+    p->slot = &p->queue[ i].row;
+    p->slot->address = new_row;
+    p->row = p->slot->data;
+    p->row_address = ROW_EMPTY; // (not a cached row)
+    p->row_index = 0;
 }
 
-void writeRow( void) {
-    // latch and program a row, skip if blank
+/**
+ * Make a row current, merging with its cached copy if present, otherwise
+ * evicting (programming) the least recently used row to make room for it
+ * @param p             context 
+ * @param new_row       row address
+ */
+void rowSelect( HEX_PARSER *p, uint32_t new_row) {
     uint8_t i;
-    uint16_t chk = 0xffff;
-    for( i=0; i< ROW_SIZE; i++) chk &= row[i];  // blank check
-    if (chk != 0xffff) { 
-        lvpWrite();
-        memset((void*)row, 0xff, sizeof(row));    // fill buffer with blanks
+    DIRECT_ROW *slot, *lru = p->cache;
+
+    for( i=0, slot=p->cache; i<DIRECT_CACHE_ROWS; i++, slot++) {
+        if (slot->address == new_row) {     // hit
+            p->stats.cacheHits++;
+            goto select;
+        }
+        if ((uint8_t)(p->cache_clock - slot->used) > (uint8_t)(p->cache_clock - lru->used))
+            lru = slot;
     }
+    // miss, prefer an empty slot
+    p->stats.cacheMisses++;
+    for( i=0, slot=p->cache; i<DIRECT_CACHE_ROWS; i++, slot++) 
+        if (slot->address == ROW_EMPTY) break;
+    if (i == DIRECT_CACHE_ROWS) {
+        slot = lru;
+        writeRow( p, slot);     // evict
+    }
+    slot->address = new_row;
+
+select:
+    slot->used = ++p->cache_clock;
+    p->slot = slot;
+    p->row = slot->data;
+    p->row_address = new_row;
+}
+
+/**
+ * Position the row buffer on a (byte) address, selecting a different row
+ * if the address belongs to a different one
+ * @param p             context 
+ * @param address       byte address (as found in the hex file)
+ */
+void rowSeek( HEX_PARSER *p, uint32_t address) {
+    uint32_t new_row = (address & (0xfffff & ~(ROW_BYTES-1)))>>1;
+    if (new_row != p->row_address) 
+        rowSelect( p, new_row);
+    p->row_index = address & (ROW_BYTES-1);
+}
+
+/**
+ * A row boundary was crossed, spill into the next one
+ */
+void rowNext( HEX_PARSER *p) {
+    rowSelect( p, p->row_address + ROW_SIZE);
+    p->row_index = 0;
 }
 
 /**
- * Align and pack words in rows, ready for lvp programming
+ * Align and pack bytes in rows, ready for lvp programming
+ * Data is copied up to each row boundary, any leftover spills into the 
+ * following row(s)
+ * @param p             context 
  * @param address       starting address 
  * @param data          buffer
  * @param data_count    number of bytes 
  */
-void packRow( uint32_t address, uint8_t *data, uint8_t data_count) {
-    // copy only the bytes from the current data packet up to the boundary of a row 
-    uint8_t  index = (address & 0x3e)>>1; 
-    uint32_t new_row = (address & 0xfffc0)>>1;
-    if (new_row != row_address) {
-        writeRow();
-        row_address = new_row;
-    }
-    // ensure data is always even (rounding up)
-    data_count = (data_count+1) & 0xfe;
-    // copy data up to the row boundaries
-    while ((data_count > 0) && (index < ROW_SIZE)){
-        uint16_t word = *data++;
-        word += ((uint16_t)(*data++)<<8);
-        row[index++] = word;
-        data_count -= 2;
-    }
-    // if a complete row was filled, proceed to programming
-    if (index == ROW_SIZE) { 
-        writeRow();
-        // next consider the split row scenario
-        if (data_count > 0) {   // leftover must spill into next row
-            row_address += ROW_SIZE;
-            index = 0;
-            while (data_count > 0){
-                uint16_t word = *data++;
-                word += ((uint16_t)(*data++)<<8);
-                row[index++] = word;
-                data_count -= 2;
-            }
+void packRow( HEX_PARSER *p, uint32_t address, const uint8_t *data, uint16_t data_count) {
+    uint8_t n;
+    rowSeek( p, address);
+    while (data_count > 0) {
+        n = ROW_BYTES - p->row_index;
+        if (n > data_count) n = data_count;
+        memcpy( (void*)&((uint8_t*)p->row)[p->row_index], (const void*)data, n);
+        data += n;
+        data_count -= n;
+        p->row_index += n;
+        if (p->row_index == ROW_BYTES) rowNext( p);
+    }
+}
+
+/**
+ * End of session, flush the entire cache and release the target
+ * @param p             context 
+ */
+void programLastRow( HEX_PARSER *p) {
+    uint8_t i;
+    queueFlush( p);
+    for( i=0; i<DIRECT_CACHE_ROWS; i++)
+        if (p->cache[i].address != ROW_EMPTY) {
+            writeRow( p, &p->cache[i]);
+            queueFlush( p);
         }
+    verifyRows( p, 0xffff);
+    p->stats.verifyCrc = p->verify_crc;
+    p->verify_crc = 0xffff;
+    p->row_address = ROW_EMPTY;
+    p->session = false;
+    orderInit();
+    if (p->write == lvpVerify) {    // verify-only, the target is unchanged
+        report.state = VERIFY_DONE;
+        p->write = lvpWrite;
+    }
+    else if (p->corrupt)            // aborted, no rows left over are erased
+        record.valid = false;
+    else 
+        replayEnd( p);
+    p->corrupt = false;
+    replayInit( p);
+    if (p->lvp) {
+        LVP_exit();
+        p->stats.commands = LVP_commandsGet();
+        p->lvp = false;    
+    }
+}
+
+/**
+ * End of file, the rows are kept (and the target held in programming mode)
+ * in case more files follow in the same session (e.g. bootloader + app)
+ * @param p             context 
+ */
+void fileEnd( HEX_PARSER *p) {
+    p->stats.files++;
+    orderInit();                // (a copy into the same entry starts over)
+#if (DIRECT_SESSION_QUIET == 0)
+    programLastRow( p);
+#else
+    p->session = true;      // closed by DIRECT_Tasks or DIRECT_SessionEnd
+#endif
+}
+
+/**
+ * Session timing, to be called every ms (USB Start Of Frame)
+ */
+void DIRECT_Tick( void) {
+    if (quiet < 0xffff) quiet++;
+#if DIRECT_READBACK
+    if (rb_quiet < 0xffff) rb_quiet++;
+#endif
+}
+
+/**
+ * Close the session after a quiet time following the end of a file
+ */
+void DIRECT_Tasks( void) {
+    // complete the cycle in progress, then verify and program the queued 
+    // rows one at a time as the target becomes ready
+    if (!LVP_busy()) {
+        verifyDue( &parser, 0xffff);    // readback of the rows programmed
+        if (parser.queue_count > 0) 
+            queueDrain( &parser);
     }
+    orderFlush();               // (can end a file)
+    // an aborted image may never reach its end of file, its session is 
+    // closed as well once the host goes quiet
+    if ((parser.session || (parser.corrupt && (quiet >= DIRECT_HOLD_QUIET))) 
+            && (quiet >= DIRECT_SESSION_QUIET))
+        programLastRow( &parser);
+#if DIRECT_READBACK
+    if (rb_open && (rb_quiet >= DIRECT_READBACK_QUIET)) {
+        rb_open = false;        // the host stopped reading, release the target
+        if (!parser.lvp) LVP_exit();
+        rb_index = 0xffff;
+    }
+#endif
+}
+
+/**
+ * Close the session immediately (control file)
+ */
+void DIRECT_SessionEnd( void) {
+    if (parser.session) 
+        programLastRow( &parser);
 }
 
-void programLastRow( void) {
-    writeRow();
-    LVP_exit();
-    lvp = false;    
+/*******************************************************************************
+ File Order
+ 
+ The data sectors are located in the FAT chains and root entries written by 
+ the host (see files.c): sectors of other files and directories (control 
+ files, macOS metadata, ...) are not parsed, the sectors of an image are 
+ parsed in file order. A sector received ahead of its turn is held (up to
+ DIRECT_HOLD_SECTORS) until the sector preceding it has been parsed, or the 
+ host goes quiet; without room to hold it the image is aborted rather than
+ parsed out of order. Sectors not allocated yet (data written before the FAT)
+ are parsed as received, sectors rewritten by the host once parsed are not
+ parsed again. The order starts over at the end of each file
+ ******************************************************************************/
+typedef struct {
+    bool     used;
+    uint8_t  position;          // index of the sector in the file
+    uint32_t sector;            // (logical) sector address 
+    uint8_t  data[ FILEIO_CONFIG_MEDIA_SECTOR_SIZE];
+} HOLD_SECTOR;
+
+static uint8_t order_entry = FILE_UNKNOWN;  // root entry of the image received
+static uint8_t order_next;                  // position of the next sector due
+#if (DIRECT_HOLD_SECTORS > 0)
+static HOLD_SECTOR hold[ DIRECT_HOLD_SECTORS];
+static HOLD_SECTOR *hold_slot;              // slot receiving the sector
+#endif
+
+/**
+ * Locate a data sector before its first segment is received
+ * @param sector_addr   sector written, translated into the image (logical) 
+ *                      sector for raw binary and compressed images
+ * @return  enum ordermode
+ */
+uint8_t orderLocate( uint32_t *sector_addr) {
+    uint8_t entry, position;
+#if (DIRECT_HOLD_SECTORS > 0)
+    uint8_t i;
+#endif
+    
+    entry = FileSectorLocate( *sector_addr, &position);
+    if (entry == FILE_UNKNOWN) 
+        return ORDER_PARSE;
+    if (entry == FILE_OTHER) {
+        parser.stats.sectorsSkipped++;
+        return ORDER_SKIP;
+    }
+    if ((parser.format != FORMAT_HEX) && (parser.file_sector != 0))
+        *sector_addr = parser.file_sector + position;   // (fragmented file)
+    if (entry != order_entry) {     // a new image
+        order_entry = entry;
+        order_next = 0;
+    }
+    if (position == order_next)
+        return ORDER_NEXT;
+    if (position < order_next) {    // rewritten (already parsed)
+        parser.stats.sectorsSkipped++;
+        return ORDER_SKIP;
+    }
+    parser.stats.sectorsEarly++;
+#if (DIRECT_HOLD_SECTORS > 0)
+    for( i=0; i<DIRECT_HOLD_SECTORS; i++) {
+        if (hold[ i].used) continue;
+        hold_slot = &hold[ i];
+        hold_slot->used = true;
+        hold_slot->position = position;
+        hold_slot->sector = *sector_addr;
+        return ORDER_HOLD;
+    }
+#endif
+    // no room left: the sector is dropped and the image aborted, the sectors
+    // still to come are only parsed for the end of file
+    order_next = position + 1;
+    imageAbort( &parser);
+    return ORDER_SKIP;
 }
 
-// the actual state machine - Hex Machina
-enum hexstate { SOL, BYTE_COUNT, ADDRESS, RECORD_TYPE, DATA, CHKSUM};
+/**
+ * Copy a segment of the sector held
+ */
+void holdPut( uint8_t *buffer, uint8_t seg) {
+#if (DIRECT_HOLD_SECTORS > 0)
+    memcpy( (void*)&hold_slot->data[ seg * MSD_OUT_EP_SIZE], (const void*)buffer, MSD_OUT_EP_SIZE);
+#endif
+}
+
+#if (DIRECT_HOLD_SECTORS > 0)
+/**
+ * Parse a sector held, the file order resumes after it
+ */
+static void holdRelease( HOLD_SECTOR *h) {
+    uint8_t seg;
+    h->used = false;
+    for( seg=0; seg < (FILEIO_CONFIG_MEDIA_SECTOR_SIZE / MSD_OUT_EP_SIZE); seg++)
+        sectorParse( h->sector, &h->data[ seg * MSD_OUT_EP_SIZE], seg);
+    order_next = h->position + 1;
+}
+
+/**
+ * Sector held with the lowest position (NULL if none)
+ */
+static HOLD_SECTOR *holdFirst( void) {
+    HOLD_SECTOR *h = NULL;
+    uint8_t i;
+    for( i=0; i<DIRECT_HOLD_SECTORS; i++) 
+        if (hold[ i].used && ((h == NULL) || (hold[ i].position < h->position)))
+            h = &hold[ i];
+    return h;
+}
+#endif
+
+/**
+ * The sector due has been parsed, release the sectors held that follow it
+ */
+void orderNext( void) {
+#if (DIRECT_HOLD_SECTORS > 0)
+    HOLD_SECTOR *h;
+#endif
+    order_next++;
+#if (DIRECT_HOLD_SECTORS > 0)
+    while (((h = holdFirst()) != NULL) && (h->position == order_next))
+        holdRelease( h);
+#endif
+}
+
+/**
+ * The host went quiet: parse the sectors held (the preceding ones are not
+ * coming, or were received before the FAT)
+ */
+void orderFlush( void) {
+#if (DIRECT_HOLD_SECTORS > 0)
+    HOLD_SECTOR *h;
+    if (quiet < DIRECT_HOLD_QUIET) return;
+    while ((h = holdFirst()) != NULL) 
+        holdRelease( h);
+#endif
+}
+
+/**
+ * Forget the file order (and the sectors held)
+ */
+void orderInit( void) {
+#if (DIRECT_HOLD_SECTORS > 0)
+    uint8_t i;
+    for( i=0; i<DIRECT_HOLD_SECTORS; i++) 
+        hold[ i].used = false;
+#endif
+    order_entry = FILE_UNKNOWN;
+}
+
+/**
+ * Announce the format and location of the file the host is writing
+ * (from its directory entry, it can be repeated as the entry gets updated)
+ * @param fmt       file format (from extension)
+ * @param cluster   first cluster (0 = not allocated yet)
+ * @param size      file size in bytes (0 = not known yet)
+ */
+void DIRECT_FileSet( DIRECT_FORMAT fmt, uint16_t cluster, uint32_t size) {
+    HEX_PARSER *p = &parser;
+    if (p->format != fmt) {     // a new file 
+        p->format = fmt;
+        p->file_sector = 0;
+        p->file_received = 0;
+        xpzInit( p);
+    }
+    if (cluster >= 2) 
+        p->file_sector = CLUSTER_SECTOR( cluster);
+    p->file_size = size;
+    if ((p->file_size > 0) && (p->file_received >= p->file_size)) {  // data came first
+        fileEnd( p);
+        p->format = FORMAT_HEX;
+    }
+}
+
+/*******************************************************************************
+ Compressed Image (.XPZ) Decoder
+ 
+ A stream of 16-bit program words, as produced by the xpzpack host utility:
+   'X','P','Z', version
+   00nnnnnn  w0 .. wn       literal, n+1 words follow (little endian)
+   01nnnnnn                 blank, skip n+1 words 
+   10nnnnnn  d              match, copy n+2 words starting d+1 words back
+   11000000  al ah          set the (word) address 
+   11000001  nl nh          blank, skip n words
+   11111111                 end of image
+ Only literal and match words enter the history window, blank runs and address
+ changes never reach the rows (blank rows are not even allocated in the cache)
+ ******************************************************************************/
+#define XPZ_VERSION     1
+#define XPZ_LITERAL     0x00
+#define XPZ_BLANK       0x40
+#define XPZ_MATCH       0x80
+#define XPZ_ADDRESS     0xC0
+#define XPZ_SKIP        0xC1
+#define XPZ_END         0xFF
+
+enum xpzstate { XPZ_HEADER, XPZ_OP, XPZ_LIT_LO, XPZ_LIT_HI, XPZ_DISTANCE, 
+                XPZ_ARG_LO, XPZ_ARG_HI, XPZ_DONE};
+
+void xpzInit( HEX_PARSER *p) {
+    p->xpz_state = XPZ_HEADER;
+    p->xpz_count = 0;
+    p->xpz_address = 0;
+    p->xpz_head = 0;
+}
+
+/**
+ * Output a decoded word, to the rows and to the history window
+ */
+void xpzPut( HEX_PARSER *p, uint16_t w) {
+    packRow( p, (uint32_t)p->xpz_address << 1, (const uint8_t*)&w, 2);
+    p->xpz_address++;
+    p->xpz_window[ p->xpz_head] = w;
+    p->xpz_head = (p->xpz_head + 1) & (DIRECT_XPZ_WINDOW - 1);
+}
+
+/**
+ * Decoder state machine
+ * @param p     context 
+ * @param buf   input bytes 
+ * @param len   number of bytes
+ * @return      false if the image is complete or invalid 
+ */
+bool xpzDecode( HEX_PARSER *p, const uint8_t *buf, uint8_t len) {
+    static const uint8_t header[] = { 'X', 'P', 'Z', XPZ_VERSION};
+    uint8_t c, i;
+
+    while( len-- > 0) {
+        c = *buf++;
+        switch( p->xpz_state) {
+            case XPZ_HEADER:
+                if (c != header[ p->xpz_count]) goto fail;
+                if (++p->xpz_count == sizeof(header)) p->xpz_state = XPZ_OP;
+                break;
+            case XPZ_OP:
+                p->xpz_op = c;
+                p->xpz_count = (c & 0x3f) + 1;
+                if (c < XPZ_BLANK) 
+                    p->xpz_state = XPZ_LIT_LO;
+                else if (c < XPZ_MATCH) 
+                    p->xpz_address += p->xpz_count;
+                else if (c < XPZ_ADDRESS) 
+                    p->xpz_state = XPZ_DISTANCE;
+                else if ((c == XPZ_ADDRESS) || (c == XPZ_SKIP)) 
+                    p->xpz_state = XPZ_ARG_LO;
+                else if (c == XPZ_END) {
+                    p->xpz_state = XPZ_DONE;
+                    return false;
+                }
+                else goto fail;
+                break;
+            case XPZ_LIT_LO:
+                p->xpz_lo = c;
+                p->xpz_state = XPZ_LIT_HI;
+                break;
+            case XPZ_LIT_HI:
+                xpzPut( p, p->xpz_lo + ((uint16_t)c << 8));
+                p->xpz_state = (--p->xpz_count > 0) ? XPZ_LIT_LO : XPZ_OP;
+                break;
+            case XPZ_DISTANCE:
+                if (c >= DIRECT_XPZ_WINDOW) goto fail;
+                i = (p->xpz_head - c - 1) & (DIRECT_XPZ_WINDOW - 1);
+                for( p->xpz_count++; p->xpz_count > 0; p->xpz_count--) {     // n+2 words
+                    xpzPut( p, p->xpz_window[ i]);
+                    i = (i + 1) & (DIRECT_XPZ_WINDOW - 1);
+                }
+                p->xpz_state = XPZ_OP;
+                break;
+            case XPZ_ARG_LO:
+                p->xpz_lo = c;
+                p->xpz_state = XPZ_ARG_HI;
+                break;
+            case XPZ_ARG_HI:
+                if (p->xpz_op == XPZ_ADDRESS) 
+                    p->xpz_address = p->xpz_lo + ((uint16_t)c << 8);
+                else 
+                    p->xpz_address += p->xpz_lo + ((uint16_t)c << 8);
+                p->xpz_state = XPZ_OP;
+                break;
+            default:
+                return false;       // ignore anything past the end
+        }
+    }
+    return true;
+
+fail:
+    p->xpz_state = XPZ_DONE;
+    return false;
+}
+
+/**
+ * Raw binary and compressed images, segments are decoded/packed directly
+ * in rows without going through the hex parser
+ * @return  true if the segment belonged to the file
+ */
+bool fileWrite( HEX_PARSER *p, uint32_t sector_addr, uint8_t *buffer, uint8_t seg) {
+    uint32_t offset;
+    uint8_t  n = MSD_OUT_EP_SIZE;
+    bool     more = true;
+    
+    if (p->format == FORMAT_HEX) return false;
+    if (p->file_sector == 0)            // cluster not allocated yet, 
+        p->file_sector = sector_addr;   // assume the file starts here
+    if (sector_addr < p->file_sector) return false;
+    offset = ((sector_addr - p->file_sector) * FILEIO_CONFIG_MEDIA_SECTOR_SIZE) + (seg * MSD_OUT_EP_SIZE);
+    if (p->file_size > 0) {
+        if (offset >= p->file_size) return false;  // beyond the end of file
+        if (p->file_size - offset < n) n = p->file_size - offset;
+    }
+    if (p->corrupt) {}                  // aborted, only the end is tracked
+    else if (p->format == FORMAT_BIN) 
+        packRow( p, offset, buffer, n);
+    else // FORMAT_XPZ, must be received in order
+        more = xpzDecode( p, buffer, n);
+    if (offset + n > p->file_received) 
+        p->file_received = offset + n;
+    if ((more == false) || ((p->file_size > 0) && (p->file_received >= p->file_size))) {
+        fileEnd( p);
+        p->format = FORMAT_HEX;
+    }
+    return true;
+}
+
+// nibble decoder indexed by (c - '0'), 0xff marks an invalid hex digit
+static const uint8_t nibble[ 'F' - '0' + 1] = {
+    0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9,       // '0'..'9'
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,               // ':'..'@'
+    0xa, 0xb, 0xc, 0xd, 0xe, 0xf                            // 'A'..'F'
+};
 
 /**
  * Parser, main state machine decoding engine
+ * Decodes a whole block of input characters in a single pass, the state is 
+ * loaded in locals on entry and saved back in the context only on exit
  * 
- * @param c     input character 
+ * @param p     context 
+ * @param buf   input characters
+ * @param len   number of characters in buffer
  * @return      true = success, false = decoding failure/invalid file contents
  */
-bool ParseHex(char c)
+bool ParseHexBlock( HEX_PARSER *p, const uint8_t *buf, uint8_t len)
 {
-    static enum hexstate state = SOL;
-    static uint8_t  bc;
-    static uint8_t  data_count;
-    static uint32_t address;
-    static uint32_t ext_address = 0;
-    static uint8_t  checksum;
-    static uint8_t  record_type;
-    static uint8_t  data_byte, data_index, data[16];
-
-    switch( state){
-        case SOL:
-            if (c == '\r') break;
-            if (c == '\n') break;
-            if (c != ':') return false; 
-            state = BYTE_COUNT;
-            bc = 0;
-            address = 0;
-            checksum = 0;
-            break;
-        case BYTE_COUNT:
-            if ( isDigit( &c) == false) { state = SOL; return false; }
-            bc++;
-            if (bc == 1) 
-                data_count = c;
-            if (bc == 2 )  {  
-                data_count = (data_count << 4) + c;
-                checksum += data_count;
-                bc = 0; 
-                if (data_count > 16) { state = SOL; return false; }
-                state = ADDRESS;
-            }
-            break;            
-        case ADDRESS:
-            if ( isDigit( &c) == false) { state = SOL; return false;}
-            bc++;
-            if (bc == 1) 
-                address = c;
-            else  {  
-                address = (address << 4) + (uint32_t)c;
-                if (bc == 4) {
-                    checksum += (address>>8) + address;
-                    bc = 0; 
-                    state = RECORD_TYPE;
-                }
-            }
-            break;                        
-        case RECORD_TYPE:
-            if ( isDigit( &c) == false) { state = SOL; return false;}
-            bc++;
-            if (bc == 1) 
-                if (c != 0) { state = SOL; return false; }
-            if (bc == 2)  {  
-                record_type = c;
-                checksum += c;
-                bc = 0; 
-                state = DATA;  // default
-                data_index = 0;
-                memset(data, 0xff, sizeof(data));
-                if (record_type == 0) break; // data record
-                if (record_type == 1) { state = CHKSUM; break; }  // EOF record
-                if (record_type == 4) break; // extended address record
-                state = SOL; 
-                return false;
-            }
-            break;            
-        case DATA:
-            if ( isDigit( &c) == false) { state = SOL; return false;}
-            bc++;
-            if (bc == 1) 
-                data[data_index] = (c<<4);
-            if (bc == 2)  {  
-                bc = 0;
-                data[data_index] += c;
-                checksum +=  data[data_index];
-                data_index++;
-                if (data_index == data_count) { 
-                    state = CHKSUM; 
+    uint8_t  s = p->state;
+    uint8_t  hi = p->hi_nibble;
+    uint8_t  n  = p->bc;
+    uint8_t  sum = p->checksum;
+    uint8_t  c, first;
+
+    while( len-- > 0) {
+        c = *buf++;
+        if (s == SOL) {
+            if ((c == '\r') || (c == '\n')) continue;
+            if (c != ':') goto fail;
+            s = BYTE_COUNT;
+            hi = 0xff;
+            sum = 0;
+            p->address = 0;
+            continue;
+        }
+        // decode one nibble, two nibbles make a byte
+        c -= '0';
+        if (c >= sizeof(nibble)) goto fail;
+        c = nibble[c];
+        if (c > 0xf) goto fail;
+        if (hi > 0xf) { hi = c; continue; }
+        c += (hi << 4);
+        hi = 0xff;
+        sum += c;
+
+        switch( s){
+            case BYTE_COUNT:
+                p->data_count = c;      // any length up to 255 is accepted
+                n = 0;
+                s = ADDRESS;
+                break;
+            case ADDRESS:
+                p->address = (p->address << 8) + c;
+                if (++n == 2) s = RECORD_TYPE;
+                break;
+            case RECORD_TYPE:
+                p->record_type = c;
+                n = 0;
+                if (c == 1) { s = CHKSUM; break; }  // EOF record
+                if ((c == 0) && !p->corrupt) {
+                    if ((p->data_count == ROW_BYTES) && ((p->address & (ROW_BYTES-1)) == 0))
+                        rowDirect( p, p->ext_address + p->address);
+                    else
+                        rowSeek( p, p->ext_address + p->address);
                 }
-            }
-            break;            
-        case CHKSUM:
-            if ( isDigit( &c) == false) { state = SOL; return false;}
-            bc++;
-            if (bc == 1) 
-                checksum += (c<<4);
-            if (bc == 2)  {  
-                bc = 0;
-                checksum += c;
-                if (checksum != 0) { 
-                    state = SOL; 
-                    return false; 
+                else if (c != 4) goto fail;
+                s = (p->data_count > 0) ? DATA : CHKSUM;
+                break;
+            case DATA:
+                // data bytes go straight into the row, spilling across row 
+                // boundaries as needed (the checksum is verified only at the 
+                // end of the record, a corrupt record aborts the session)
+                if ((p->record_type == 0) && !p->corrupt) {
+                    ((uint8_t*)p->row)[p->row_index++] = c;
+                    if ((p->row_index == ROW_BYTES) && (n+1 < p->data_count)) 
+                        rowNext( p);
                 }
+                else if (n < sizeof(p->data)) p->data[n] = c;
+                if (++n == p->data_count) s = CHKSUM;
+                break;
+            case CHKSUM:
+                if (sum != 0) goto corrupt;
+                s = SOL;
                 // chksum is good 
-                state = SOL; 
-                if (record_type == 0) 
-                    packRow( ext_address + address, data, data_count);
-                else if (record_type == 4) 
-                    ext_address = ((uint32_t)(data[0]) << 24) + ((uint32_t)(data[1]) << 16);
-                else if (record_type == 1) { 
-                    programLastRow();
-                    ext_address = 0;
+                if (p->record_type == 0) {
+                    if (p->corrupt) break;
+                    // fast path, the row received in place joins the queue
+                    if ((p->data_count == ROW_BYTES) && ((p->address & (ROW_BYTES-1)) == 0)) {
+                        c = rowSpan( p->slot, &first);
+                        if (c > 0) 
+                            queueAppend( p, first, c);
+                        p->stats.fastRows++;
+                    }
+                    break;              // data is already in place
                 }
-                else return false;
-            }
-            break;            
-        default:
-            break;
+                else if (p->record_type == 4) 
+                    p->ext_address = ((uint32_t)(p->data[0]) << 24) + ((uint32_t)(p->data[1]) << 16);
+                else { 
+                    fileEnd( p);
+                    p->ext_address = 0;
+                }
+                break;
+            default:
+                goto fail;
+        }
     }
+    p->state = s;
+    p->hi_nibble = hi;
+    p->bc = n;
+    p->checksum = sum;
     return true;
+
+fail:
+    if ((s != DATA) && (s != CHKSUM)) {
+        p->state = SOL;
+        return false;
+    }
+corrupt:
+    // the record bytes already reached the row cache
+    p->state = SOL;
+    p->stats.recordErrors++;
+    imageAbort( p);
+    return false;
+}
+
+#if DIRECT_READBACK
+/*******************************************************************************
+ Target Readback Files (DIRECT_READBACK builds)
+ 
+ READ.HEX and FLASH.BIN (see files.c) are produced one segment at a time as 
+ the host reads them, straight from the target (held in programming mode 
+ until the host stops reading), no image is buffered. READ.HEX is made of 
+ fixed size records so that any offset maps directly to a record, the record 
+ straddling two segments is kept formatted in a line buffer
+ ******************************************************************************/
+/**
+ * Hold the target in programming mode 
+ * @return  false while a programming session owns the target
+ */
+static bool readbackOpen( void) {
+    if (parser.lvp || (parser.queue_count > 0)) return false;
+    LVP_wait();
+    rb_quiet = 0;
+    if (!LVP_inProgress()) {
+        LVP_enter();
+        rb_index = 0xffff;      // (the target may have changed)
+    }
+    rb_open = true;
+    return true;
+}
+
+/**
+ * Format a record of READ.HEX in the line buffer
+ * @param index     program memory records first, then the extended address
+ *                  record, the config space records and the end of file
+ */
+static void hexRecord( uint16_t index) {
+    uint16_t address, w;
+    uint8_t  i, sum, *s = rb_line;
+
+    if (index == rb_index) return;
+    rb_index = index;
+    if (index == READBACK_RECORDS) {
+        memcpy( (void*)rb_line, (const void*)":020000040001F9\r\n", READBACK_EXT_RECORD);
+        return;
+    }
+    if (index > READBACK_RECORDS + 2) {
+        memcpy( (void*)rb_line, (const void*)":00000001FF\r\n", READBACK_EOF_RECORD);
+        return;
+    }
+    if (index < READBACK_RECORDS) 
+        address = index * 8;
+    else 
+        address = LVP_CFG_SPACE + (index - READBACK_RECORDS - 1) * 8;
+    *s++ = ':';
+    s = hexPut( s, 16);                         // byte count
+    s = hexPut( s, (uint8_t)(address >> 7));    // byte address (64K page)
+    s = hexPut( s, (uint8_t)(address << 1));
+    s = hexPut( s, 0);                          // data record
+    sum = 16 + (uint8_t)(address >> 7) + (uint8_t)(address << 1);
+    LVP_addressLoad( address);
+    for( i=0; i<8; i++) {
+        w = LVP_readNext();
+        s = hexPut( s, (uint8_t)w);             // little endian 
+        s = hexPut( s, (uint8_t)(w >> 8));
+        sum += (uint8_t)w + (uint8_t)(w >> 8);
+    }
+    s = hexPut( s, (uint8_t)(0 - sum));
+    *s++ = '\r';
+    *s = '\n';
+}
+
+void DIRECT_ReadbackGet( uint32_t sector_addr, uint8_t *buffer, uint8_t seg) {
+    uint32_t offset;
+    uint16_t index, w;
+    uint8_t  i, n, col, len;
+
+    if (sector_addr < CLUSTER_SECTOR( READBACK_HEX_CLUSTER)) return;
+    if (sector_addr >= CLUSTER_SECTOR( READBACK_BIN_CLUSTER)) {  // FLASH.BIN
+        offset = (sector_addr - CLUSTER_SECTOR( READBACK_BIN_CLUSTER)) * 
+                FILEIO_CONFIG_MEDIA_SECTOR_SIZE + seg * MSD_IN_EP_SIZE;
+        if ((offset >= READBACK_BIN_SIZE) || !readbackOpen()) return;
+        LVP_addressLoad( offset / 2);
+        for( i=0; i<MSD_IN_EP_SIZE; i+=2) {
+            w = LVP_readNext();
+            buffer[ i] = (uint8_t)w;
+            buffer[ i+1] = (uint8_t)(w >> 8);
+        }
+        return;
+    }
+    // READ.HEX
+    offset = (sector_addr - CLUSTER_SECTOR( READBACK_HEX_CLUSTER)) * 
+            FILEIO_CONFIG_MEDIA_SECTOR_SIZE + seg * MSD_IN_EP_SIZE;
+    if ((offset >= READBACK_HEX_SIZE) || !readbackOpen()) return;
+    for( i=0; (i < MSD_IN_EP_SIZE) && (offset < READBACK_HEX_SIZE); i+=n, offset+=n) {
+        len = READBACK_RECORD;
+        if (offset < READBACK_RECORDS * (uint32_t)READBACK_RECORD) {
+            index = offset / READBACK_RECORD;
+            col = offset % READBACK_RECORD;
+        }
+        else {
+            w = offset - READBACK_RECORDS * (uint32_t)READBACK_RECORD;   // (tail < 64K)
+            if (w < READBACK_EXT_RECORD) {
+                index = READBACK_RECORDS;
+                col = w;
+                len = READBACK_EXT_RECORD;
+            }
+            else if (w < READBACK_EXT_RECORD + 2 * READBACK_RECORD) {
+                w -= READBACK_EXT_RECORD;
+                index = READBACK_RECORDS + 1 + w / READBACK_RECORD;
+                col = w % READBACK_RECORD;
+            }
+            else {
+                index = READBACK_RECORDS + 3;
+                col = w - READBACK_EXT_RECORD - 2 * READBACK_RECORD;
+                len = READBACK_EOF_RECORD;
+            }
+        }
+        hexRecord( index);
+        n = len - col;
+        if (n > MSD_IN_EP_SIZE - i) n = MSD_IN_EP_SIZE - i;
+        memcpy( (void*)&buffer[ i], (const void*)&rb_line[ col], n);
+    }
 }
+#endif
@@ -18,6 +18,9 @@ limitations under the License.
 #include "fileio_config.h"
 #include <fileio.h>
 
+#ifndef DIRECT_H
+#define	DIRECT_H
+
 uint8_t DIRECT_MediaDetect(void* config);
 FILEIO_MEDIA_INFORMATION * DIRECT_MediaInitialize(void* config);
 uint8_t DIRECT_SectorRead(void* config, uint32_t sector_addr, uint8_t* buffer, uint8_t seg);
@@ -25,9 +28,240 @@ uint8_t DIRECT_SectorWrite(void* config, uint32_t sector_addr, uint8_t* buffer,
 uint16_t DIRECT_SectorSizeRead(void* config);
 uint32_t DIRECT_CapacityRead(void* config);
 uint8_t DIRECT_WriteProtectStateGet(void* config);
+uint8_t DIRECT_SegmentBlank(void* config, uint32_t sector_addr, uint8_t seg);
+
+// number of rows held in the write-back cache (each row takes 2*ROW_SIZE+5 bytes of RAM)
+#if !defined(DIRECT_CACHE_ROWS)
+    #define DIRECT_CACHE_ROWS 3
+#endif
+
+// words per row assembled (cache/queue entry): the largest device row to be 
+// programmed in one cycle, smaller device rows are programmed in turn (32, 64)
+#if !defined(DIRECT_ROW_SIZE)
+    #define DIRECT_ROW_SIZE 32
+#endif
+
+// rows queued for programming between the cache and the target, the host is
+// slowed down only when the queue is full (each row takes 2*ROW_SIZE+7 bytes 
+// of RAM, at least 1)
+#if !defined(DIRECT_QUEUE_ROWS)
+    #define DIRECT_QUEUE_ROWS 1
+#endif
+
+// differential programming: without a record of the previous image the 
+// target rows are read back and only the rows that differ are erased and 
+// programmed (false = bulk erase and program everything), devices with more
+// than DIRECT_REPLAY_FLASH words of program memory are always bulk erased
+#if !defined(DIRECT_DIFFERENTIAL)
+    #define DIRECT_DIFFERENTIAL true
+#endif
+
+// read back and check each row after programming (see DIRECT_VerifySet)
+#if !defined(DIRECT_VERIFY)
+    #define DIRECT_VERIFY true
+#endif
+
+// rows waiting for readback, read in one pass when the target PC cannot be 
+// loaded (6-bit family: moving back is a reset and increments from 0)
+#if !defined(DIRECT_VERIFY_ROWS)
+    #define DIRECT_VERIFY_ROWS 4
+#endif
+
+// history window of the compressed image decoder (in words, power of 2, <=64)
+#if !defined(DIRECT_XPZ_WINDOW)
+    #define DIRECT_XPZ_WINDOW 32
+#endif
+
+// replay suppression record: rows tagged per session (the following ones are 
+// compared with the target) and program memory covered (words)
+#if !defined(DIRECT_REPLAY_ROWS)
+    #define DIRECT_REPLAY_ROWS 64
+#endif
+#if !defined(DIRECT_REPLAY_FLASH)
+    #define DIRECT_REPLAY_FLASH 0x2000
+#endif
+
+// target readback files (READ.HEX, FLASH.BIN), off by default: they take the
+// end of the volume (123 of its 256 clusters for 8K words) from the files of
+// the host. Program memory covered (words, multiple of 256) and time (ms) 
+// without reads releasing the target
+#if !defined(DIRECT_READBACK)
+    #define DIRECT_READBACK false
+#endif
+#if !defined(DIRECT_READBACK_WORDS)
+    #define DIRECT_READBACK_WORDS 0x2000
+#endif
+#if !defined(DIRECT_READBACK_QUIET)
+    #define DIRECT_READBACK_QUIET 500
+#endif
+
+// quiet time (ms) closing a programming session after the end of a file, 
+// files copied in one batch are programmed under a single bulk erase 
+// (0 = each file is a session of its own)
+#if !defined(DIRECT_SESSION_QUIET)
+    #define DIRECT_SESSION_QUIET 500
+#endif
+
+// image sectors received ahead of their turn (the FAT chain tells the file 
+// order) held until the preceding sector arrives or for a quiet time (ms), 
+// each takes 512 bytes of RAM (0 = an image received out of order is aborted)
+#if !defined(DIRECT_HOLD_SECTORS)
+    #define DIRECT_HOLD_SECTORS 0
+#endif
+#if !defined(DIRECT_HOLD_QUIET)
+    #define DIRECT_HOLD_QUIET 50
+#endif
+
+// control file closing a session immediately (8 character name, any extension)
+#define DIRECT_SESSION_FILE "END     "
+
+// control file (or reserved image name, any extension) making the next session
+// verify-only, the report is published in VERIFY.TXT
+#define DIRECT_VERIFY_FILE  "VERIFY  "
+
+// verify-only sessions: stop comparing at the first row differing, number of 
+// rows differing listed in the report (<= 28)
+#if !defined(DIRECT_VERIFY_STOP)
+    #define DIRECT_VERIFY_STOP false
+#endif
+#if !defined(DIRECT_VERIFY_LIST)
+    #define DIRECT_VERIFY_LIST 8
+#endif
+
+#define ROW_SIZE    DIRECT_ROW_SIZE
+#define ROW_BYTES   (ROW_SIZE * 2)
+#define DIRECT_REPLAY_MAP   (DIRECT_REPLAY_FLASH / ROW_SIZE / 8)
+
+typedef struct {
+    uint16_t cacheHits;         // row selections served by the row cache
+    uint16_t cacheMisses;       // row selections requiring a new/evicted row
+    uint16_t parserSize;        // RAM footprint of a HEX_PARSER instance (bytes)
+    uint16_t rowsSkipped;       // rows already in the target (replayed or compared)
+    uint16_t replays;           // sessions dropped entirely (identical replay)
+    uint16_t patches;           // sessions applied as a patch of the previous one
+    uint16_t replayErrors;      // patch errors: config bits to set (target erased), rows split
+    uint16_t diffs;             // sessions programmed differentially (no bulk erase)
+    uint16_t files;             // files received (end of file/image)
+    uint16_t recordErrors;      // corrupt hex records (session aborted, not recorded)
+    uint16_t sectorsSkipped;    // sectors of other files/directories or rewritten (not parsed)
+    uint16_t sectorsEarly;      // image sectors received ahead of the file order
+    uint16_t fastRows;          // row aligned full row records (fast path)
+    uint16_t cycles;            // programming/erase cycles completed in background
+    uint16_t queueHigh;         // highest number of rows waiting in the queue
+    uint16_t queueFull;         // rows evicted while the queue was full (host held)
+    uint16_t rowsVerified;      // rows read back after programming
+    uint16_t verifyErrors;      // rows read back with a mismatch
+    uint16_t verifyCrc;         // CRC of the readback of the last session
+    uint32_t commands;          // ICSP commands sent in the last session
+    uint8_t  socketsFailed;     // gang: DAT lines of the sockets failed (last session)
+} DIRECT_STATISTICS;
+
+// input file formats
+typedef enum { 
+    FORMAT_HEX,                 // INTEL hex (default)
+    FORMAT_BIN,                 // raw image, little-endian program words from address 0
+    FORMAT_XPZ                  // compressed image (see xpzpack)
+} DIRECT_FORMAT;
+
+// hex record decoder states (Hex Machina)
+enum hexstate { SOL, BYTE_COUNT, ADDRESS, RECORD_TYPE, DATA, CHKSUM};
+
+// row write-back cache entry, records are merged per row and a row is 
+// programmed only when evicted (least recently used) or at the end of the file
+typedef struct {
+    uint16_t data[ ROW_SIZE];   // row contents (blank = 0xffff)
+    uint32_t address;           // destination address of the row
+    uint8_t  used;              // LRU time stamp
+} DIRECT_ROW;
+
+// programming queue entry, a row evicted from the cache (or received in 
+// place by the fast path) with its span
+typedef struct {
+    DIRECT_ROW row;
+    uint8_t  first;             // index of the first word to latch
+    uint8_t  n;                 // number of words to latch
+} DIRECT_QUEUED;
+
+// row programmed, waiting for readback
+typedef struct {
+    uint16_t address;           // address of the first word
+    uint16_t expect;            // CRC of the words latched
+    uint8_t  n;                 // words to read back
+} DIRECT_VERIFY_ROW;
+
+struct HEX_PARSER_s;
+typedef void (*DIRECT_ROW_HANDLER)( struct HEX_PARSER_s *p, DIRECT_ROW *row, uint8_t first, uint8_t n);
+
+// stream context, holds the complete state of a parse/pack/program stream
+typedef struct HEX_PARSER_s {
+    // hex record decoder, preserved across segments (records can span packets)
+    uint8_t  state;             // enum hexstate
+    uint8_t  hi_nibble;         // 0xff when expecting the first digit of a byte
+    uint8_t  bc;                // byte counter within the current field
+    uint8_t  data_count;
+    uint16_t address;
+    uint32_t ext_address;
+    uint8_t  checksum;
+    uint8_t  record_type;
+    uint8_t  data[2];           // extended address record payload
+    bool     corrupt;           // flag: image aborted (corrupt record, sector missing)
+    // row assembly
+    DIRECT_ROW cache[ DIRECT_CACHE_ROWS];
+    uint8_t  cache_clock;       // LRU time reference
+    DIRECT_ROW *slot;           // cache entry of the row being formed
+    uint16_t *row;              // buffer containing row being formed
+    uint32_t row_address;       // destination address of current row 
+    uint8_t  row_index;         // byte offset of the next byte within the row
+    DIRECT_ROW_HANDLER write;   // row output (programming) handler 
+    DIRECT_QUEUED queue[ DIRECT_QUEUE_ROWS];    // rows waiting for the handler
+    uint8_t  queue_head;        // oldest entry
+    uint8_t  queue_count;       // entries in use
+    bool     lvp;               // flag: low voltage programming in progress
+    bool     session;           // flag: end of file seen, session still open 
+    // file being streamed, as announced by its directory entry 
+    DIRECT_FORMAT format;       // input format 
+    uint32_t file_sector;       // first sector of the file (0 = not known yet)
+    uint32_t file_size;         // size in bytes (0 = not known yet)
+    uint32_t file_received;     // bytes received (highest offset written)
+    // compressed image decoder
+    uint8_t  xpz_state;
+    uint8_t  xpz_op;            // current opcode 
+    uint8_t  xpz_count;         // words (or header bytes) left in the current token
+    uint8_t  xpz_lo;            // low byte of the argument/word being received
+    uint16_t xpz_address;       // next (word) address 
+    uint16_t xpz_window[ DIRECT_XPZ_WINDOW];
+    uint8_t  xpz_head;          // window insertion point 
+    // replay suppression (programming session)
+    uint8_t  replay_mode;       
+    uint16_t replay_rows;       // rows flushed in the session
+    uint16_t replay_crc;        // chained CRC of the rows flushed 
+    bool     replay_keep;       // session can be recorded 
+    uint8_t  replay_map[ DIRECT_REPLAY_MAP];    // rows programmed (bit per row)
+    uint8_t  replay_skip[ DIRECT_REPLAY_MAP];   // rows skipped (already in the target)
+    // read-after-write verification
+    DIRECT_VERIFY_ROW verify[ DIRECT_VERIFY_ROWS];  // rows waiting for readback
+    uint8_t  verify_count;      // entries in use
+    uint16_t verify_crc;        // chained CRC of the session readback
+    DIRECT_STATISTICS stats;
+} HEX_PARSER;
 
 void DIRECT_Initialize( void);
 bool DIRECT_ProgrammingInProgress( void);
+const DIRECT_STATISTICS * DIRECT_StatisticsGet( void);
+void DIRECT_FileSet( DIRECT_FORMAT format, uint16_t cluster, uint32_t size);
+void DIRECT_Tick( void);
+void DIRECT_Tasks( void);
+void DIRECT_SessionEnd( void);
+void DIRECT_VerifySet( bool on);
+void DIRECT_VerifyOnly( void);
+
+// stream API (the MSD interface uses a single instance)
+void HEX_ParserInit( HEX_PARSER *p, DIRECT_ROW_HANDLER write);
+bool ParseHexBlock( HEX_PARSER *p, const uint8_t *buf, uint8_t len);
+void packRow( HEX_PARSER *p, uint32_t address, const uint8_t *data, uint16_t data_count);
+void programLastRow( HEX_PARSER *p);
+void lvpWrite( HEX_PARSER *p, DIRECT_ROW *row, uint8_t first, uint8_t n);
+void lvpVerify( HEX_PARSER *p, DIRECT_ROW *row, uint8_t first, uint8_t n);
 
 #if !defined(DRV_FILEIO_CONFIG_INTERNAL_FLASH_MAX_NUM_FILES_IN_ROOT)
     #define DRV_FILEIO_CONFIG_INTERNAL_FLASH_MAX_NUM_FILES_IN_ROOT 16
@@ -80,3 +314,5 @@ bool DIRECT_ProgrammingInProgress( void);
     #error "Number of root file entries must be a multiple of 16.  Please adjust the definition in the FSconfig.h file."
 #endif
 
+#endif	/* DIRECT_H */
+
@@ -143,20 +143,115 @@ void FATRecordInit( void)
 {
 }
 
+/**
+ * Entry of a cluster in the (fabricated) FAT
+ */
+static uint16_t fatEntry( uint16_t n)
+{
+    if (n == 0) return 0xFF8;   // Copy of the media descriptor 0xFF8
+    if ((n == 1) || (n == README_CLUSTER)) return 0xFFF;   // readme.htm
+    if (n == VERIFY_CLUSTER) return 0xFFF;                  // verify.txt
+    if ((n >= HOST_CLUSTERS) && (n < VERIFY_CLUSTER)) return 0xFF7;    // bad (not tracked)
+#if DIRECT_READBACK
+    // readback files, contiguous chains
+    if ((n >= READBACK_HEX_CLUSTER) && (n < READBACK_BIN_CLUSTER))
+        return (n == READBACK_BIN_CLUSTER - 1) ? 0xFFF : n + 1;
+    if ((n >= READBACK_BIN_CLUSTER) && (n < 2 + DRV_FILEIO_INTERNAL_FLASH_CONFIG_DRIVE_CAPACITY))
+        return (n == 1 + DRV_FILEIO_INTERNAL_FLASH_CONFIG_DRIVE_CAPACITY) ? 0xFFF : n + 1;
+#endif
+    return 0;                   // free
+}
+
 void FATRecordGet( uint8_t * buffer, uint8_t seg)
 {
-    memset( (void*)buffer, 0, MSD_IN_EP_SIZE);
-    if (seg == 0) {
-        buffer[ 0] = 0xF8;      // Copy of the media descriptor 0xFF8
-        buffer[ 1] = 0xFF;   
-        buffer[ 2] = 0xFF;
-        buffer[ 3] = 0xFF;      // 2 - first/last cluster in short file chain
-        buffer[ 4] = 0x0F;      // readme.htm
+    uint16_t b = seg * MSD_IN_EP_SIZE, n, e0, e1;
+    uint8_t i;
+
+    for( i=0; i<MSD_IN_EP_SIZE; i++, b++) {    // 3 bytes per pair of entries
+        n = (b / 3) * 2;
+        e0 = fatEntry( n);
+        e1 = fatEntry( n + 1);
+        switch( b % 3) {
+            case 0:  buffer[ i] = (uint8_t)e0; break;
+            case 1:  buffer[ i] = (uint8_t)(e0 >> 8) | (uint8_t)(e1 << 4); break;
+            default: buffer[ i] = (uint8_t)(e1 >> 4); break;
+        }
     }
 }
 
+// FAT chains and root entries written by the host (clusters below the files
+// fabricated here)
+static uint8_t  fat_next[ HOST_CLUSTERS];   // next cluster (0 = free, 0xFF = end of chain)
+static uint8_t  root_first[ ROOT_ENTRIES];  // first cluster of each entry (0 = none)
+static uint16_t root_image;                 // entries holding an image (bit per entry)
+static uint8_t  last_entry = FILE_UNKNOWN;  // last sector located (image entry)
+static uint8_t  last_cluster, last_position;
+
+/**
+ * Record a FAT entry written by the host
+ */
+static void fatNext( uint16_t n, uint16_t e)
+{
+    if (n >= HOST_CLUSTERS) return;
+    if ((e != 0) && ((e < 2) || (e >= HOST_CLUSTERS))) e = 0xFF;   // (end of chain)
+    fat_next[ n] = (uint8_t)e;
+}
+
 void FATRecordSet( uint8_t * buffer, uint8_t seg)
 {   
+    static uint8_t pair[ 2];    // first bytes of a pair of entries (split over segments)
+    uint16_t b = seg * MSD_OUT_EP_SIZE, n;
+    uint8_t i;
+
+    last_entry = FILE_UNKNOWN;
+    for( i=0; i<MSD_OUT_EP_SIZE; i++, b++) {   // 3 bytes per pair of entries
+        if (b % 3 < 2) {
+            pair[ b % 3] = buffer[ i];
+            continue;
+        }
+        n = (b / 3) * 2;
+        fatNext( n, pair[ 0] + ((uint16_t)(pair[ 1] & 0x0F) << 8));
+        fatNext( n + 1, (pair[ 1] >> 4) + ((uint16_t)buffer[ i] << 4));
+    }
+}
+
+/**
+ * Position of a cluster in a chain 
+ * @return  index in the chain, 0xFF if not found
+ */
+static uint8_t chainFind( uint8_t c, uint8_t cluster)
+{
+    uint8_t i;
+    // (bounded: a chain being rewritten can loop)
+    for( i=0; (c >= 2) && (c < HOST_CLUSTERS) && (i < HOST_CLUSTERS); i++, c = fat_next[ c])
+        if (c == cluster) return i;
+    return 0xFF;
+}
+
+uint8_t FileSectorLocate( uint32_t sector_addr, uint8_t *position)
+{
+    uint8_t i, n, cluster;
+
+    if ((sector_addr < CLUSTER_SECTOR( 2)) || (sector_addr >= CLUSTER_SECTOR( HOST_CLUSTERS)))
+        return FILE_UNKNOWN;
+    cluster = (uint8_t)(sector_addr - CLUSTER_SECTOR( 0));
+    // (files are mostly written in order) the cluster following the last one
+    if ((last_entry != FILE_UNKNOWN) && (fat_next[ last_cluster] == cluster)) {
+        last_cluster = cluster;
+        *position = ++last_position;
+        return last_entry;
+    }
+    for( i=0; i<ROOT_ENTRIES; i++) {
+        n = chainFind( root_first[ i], cluster);
+        if (n == 0xFF) continue;
+        if ((root_image & (1u << i)) == 0) return FILE_OTHER;
+        last_entry = i;
+        last_cluster = cluster;
+        last_position = n;
+        *position = n;
+        return i;
+    }
+    return FILE_UNKNOWN;
 }
 
 //------------------------------------------------------------------------------
@@ -217,6 +312,35 @@ const uint8_t entry0[ ROOT_ENTRY_SIZE] = {
     sizeof(readme), 0x00, 0x00, 0x00,         // README string size (<256)
 };
 
+// files fabricated here (read-only, contents produced as they are read)
+#define READBACK_ENTRY( n0, n1, n2, n3, n4, n5, n6, n7, e0, e1, e2, cluster, size) { \
+    n0, n1, n2, n3, n4, n5, n6, n7, e0, e1, e2, \
+    0x21,           /* read-only regular file */ \
+    0x00,           /* Reserved */ \
+    0x00,           /* Creation time, fine res 10 ms units */ \
+    TIMEL(MAJOR, MINOR, 0), TIMEH(MAJOR, MINOR, 0), \
+    DATEL(YEAR, MONTH, DAY), DATEH(YEAR, MONTH, DAY), \
+    DATEL(YEAR, MONTH, DAY), DATEH(YEAR, MONTH, DAY), \
+    0x00, 0x00,     /* Extended Attributes */ \
+    TIMEL(MAJOR, MINOR, 0), TIMEH(MAJOR, MINOR, 0), \
+    DATEL(YEAR, MONTH, DAY), DATEH(YEAR, MONTH, DAY), \
+    (uint8_t)(cluster), (uint8_t)((cluster) >> 8), \
+    (uint8_t)(size), (uint8_t)((size) >> 8), (uint8_t)((size) >> 16), (uint8_t)((size) >> 24) }
+
+#if DIRECT_READBACK
+const uint8_t entry2[ ROOT_ENTRY_SIZE] = READBACK_ENTRY( 
+    'R','E','A','D',' ',' ',' ',' ', 'H','E','X', 
+    READBACK_HEX_CLUSTER, READBACK_HEX_SIZE);
+
+const uint8_t entry3[ ROOT_ENTRY_SIZE] = READBACK_ENTRY( 
+    'F','L','A','S','H',' ',' ',' ', 'B','I','N', 
+    READBACK_BIN_CLUSTER, READBACK_BIN_SIZE);
+#endif
+
+const uint8_t entry4[ ROOT_ENTRY_SIZE] = READBACK_ENTRY( 
+    'V','E','R','I','F','Y',' ',' ', 'T','X','T', 
+    VERIFY_CLUSTER, VERIFY_REPORT_SIZE);
+
 void RootRecordInit( void)
 {
 }
@@ -229,8 +353,70 @@ void RootRecordGet( uint8_t * buffer, uint8_t seg)
         // add the README.HTM file
         memcpy( (void*)&buffer[ ROOT_ENTRY_SIZE], (const void*)entry1, ROOT_ENTRY_SIZE );
     }
+#if DIRECT_READBACK
+    else if (seg == 1) {    // readback files
+        memcpy( (void*)&buffer[ 0], (const void*)entry2, ROOT_ENTRY_SIZE ); 
+        memcpy( (void*)&buffer[ ROOT_ENTRY_SIZE], (const void*)entry3, ROOT_ENTRY_SIZE );
+    }
+#endif
+    else if (seg == ROOT_SEGMENTS - 1) {    // verify-only report 
+        memcpy( (void*)&buffer[ 0], (const void*)entry4, ROOT_ENTRY_SIZE ); 
+    }
 }
 
 void RootRecordSet( uint8_t *buffer, uint8_t seg)
 {
+    static bool end_found, end_present, verify_found, verify_present;
+    static bool apple;          // long name starting with "._" (macOS metadata file)
+    uint8_t i, e = seg * (MSD_OUT_EP_SIZE / ROOT_ENTRY_SIZE);
+    uint16_t cluster;
+    uint32_t size;
+    bool other;
+    
+    if (seg == 0) {
+        end_found = verify_found = false;
+        root_image = 0;
+    }
+    last_entry = FILE_UNKNOWN;
+    for( i=0; i < MSD_OUT_EP_SIZE; i+= ROOT_ENTRY_SIZE, buffer+= ROOT_ENTRY_SIZE, e++) {
+        root_first[ e] = 0;
+        if ((buffer[0] == 0) || (buffer[0] == ENTRY_DELETED)) continue;  // free entry
+        if (buffer[ ENTRY_ATTRIBUTES] == ATTR_LFN) {
+            // the part preceding the entry holds the first characters (UCS-2)
+            apple = (buffer[ 1] == '.') && (buffer[ 3] == '_');
+            continue;
+        }
+        other = apple || (buffer[ ENTRY_ATTRIBUTES] & ATTR_DIRECTORY);
+        apple = false;
+        if (buffer[ ENTRY_ATTRIBUTES] & ATTR_VOLUME) continue;
+        cluster = buffer[ ENTRY_CLUSTER] + ((uint16_t)buffer[ ENTRY_CLUSTER+1] << 8);
+        if (cluster >= HOST_CLUSTERS) continue;     // (our own files, echoed back)
+        root_first[ e] = (uint8_t)cluster;
+        if (other) continue;    // (contents not parsed)
+        if (memcmp( (const void*)buffer, (const void*)DIRECT_SESSION_FILE, 8) == 0) {
+            // the host keeps rewriting the entry, act only when it appears
+            if (!end_present) DIRECT_SessionEnd();
+            end_found = true;
+            continue;
+        }
+        if (memcmp( (const void*)buffer, (const void*)DIRECT_VERIFY_FILE, 8) == 0) {
+            if (!verify_present) DIRECT_VerifyOnly();   // (the image can follow)
+            verify_found = true;
+        }
+        memcpy( (void*)&size, (const void*)&buffer[ ENTRY_FILE_SIZE_OFFSET], sizeof(size));
+        if (memcmp( (const void*)&buffer[ ENTRY_EXTENSION], (const void*)"HEX", 3) == 0)
+            root_image |= (1u << e);
+        else if (memcmp( (const void*)&buffer[ ENTRY_EXTENSION], (const void*)"BIN", 3) == 0) {
+            DIRECT_FileSet( FORMAT_BIN, cluster, size);
+            root_image |= (1u << e);
+        }
+        else if (memcmp( (const void*)&buffer[ ENTRY_EXTENSION], (const void*)"XPZ", 3) == 0) {
+            DIRECT_FileSet( FORMAT_XPZ, cluster, size);
+            root_image |= (1u << e);
+        }
+    }
+    if (seg == (FILEIO_CONFIG_MEDIA_SECTOR_SIZE / MSD_OUT_EP_SIZE) - 1) {
+        end_present = end_found;
+        verify_present = verify_found;
+    }
 }
@@ -24,6 +24,65 @@ limitations under the License.
 #define ROOT_ENTRY_SIZE             32  // standard root entry size
 #define ENTRY_FILE_SIZE_OFFSET      28  // offset to entry.file_size field
 #define ENTRY_CLUSTER               26  // offset of entry.cluster 
+#define ENTRY_EXTENSION             8   // offset of entry.extension (3 characters)
+#define ENTRY_ATTRIBUTES            11  // offset of entry.attributes
+#define ENTRY_DELETED               0xE5 // first name character of a deleted entry
+
+#define ATTR_VOLUME                 0x08
+#define ATTR_DIRECTORY              0x10
+#define ATTR_LFN                    0x0F // long file name part
+
+// one sector per cluster, cluster #2 is the first data sector
+#define CLUSTER_SECTOR(c)   ((uint32_t)(c) - 2 + DRV_FILEIO_INTERNAL_FLASH_OVERHEAD_SECTORS)
+#define SIZE_CLUSTERS(s)    (((s) + FILEIO_CONFIG_MEDIA_SECTOR_SIZE - 1) / FILEIO_CONFIG_MEDIA_SECTOR_SIZE)
+
+#define README_CLUSTER          2
+
+#if DIRECT_READBACK
+// target readback files, placed at the end of the volume (hosts allocate new 
+// files from the first free cluster): READ.HEX made of fixed size records 
+// (8 words each) followed by the config space and FLASH.BIN (raw words)
+#define READBACK_RECORD         45  // ":10AAAA00" + 16 data bytes + checksum + CRLF
+#define READBACK_EXT_RECORD     17  // ":020000040001F9" + CRLF (config space)
+#define READBACK_EOF_RECORD     13  // ":00000001FF" + CRLF
+#define READBACK_RECORDS        (DIRECT_READBACK_WORDS / 8)
+#define READBACK_HEX_SIZE       (READBACK_RECORDS * 45ul + READBACK_EXT_RECORD + \
+                                 2 * READBACK_RECORD + READBACK_EOF_RECORD)
+#define READBACK_BIN_SIZE       (DIRECT_READBACK_WORDS * 2ul)
+#define READBACK_BIN_CLUSTER    (2 + DRV_FILEIO_INTERNAL_FLASH_CONFIG_DRIVE_CAPACITY - \
+                                 SIZE_CLUSTERS( READBACK_BIN_SIZE))
+#define READBACK_HEX_CLUSTER    (READBACK_BIN_CLUSTER - SIZE_CLUSTERS( READBACK_HEX_SIZE))
+#define ROOT_SEGMENTS           3   // root segments holding the entries fabricated
+#else
+#define ROOT_SEGMENTS           2
+#endif
+
+// verify-only session report (VERIFY.TXT), 32 lines of 16 characters, below
+// the readback files or in the last cluster
+#if DIRECT_READBACK
+#define VERIFY_CLUSTER          (READBACK_HEX_CLUSTER - 1)
+#else
+#define VERIFY_CLUSTER          (1 + DRV_FILEIO_INTERNAL_FLASH_CONFIG_DRIVE_CAPACITY)
+#endif
+#define VERIFY_REPORT_SIZE      FILEIO_CONFIG_MEDIA_SECTOR_SIZE
+#define VERIFY_LINE             16
+
+#if (VERIFY_CLUSTER <= README_CLUSTER)
+    #error "The readback files do not fit in the volume, reduce DIRECT_READBACK_WORDS"
+#endif
+
+// clusters allocated by the host (the FAT chains are tracked in RAM, 1 byte 
+// per cluster), located by FileSectorLocate. The clusters left between them
+// and the files fabricated here are marked bad in the FAT
+#if (VERIFY_CLUSTER > 0xFF)
+    #define HOST_CLUSTERS       0xFF
+#else
+    #define HOST_CLUSTERS       VERIFY_CLUSTER
+#endif
+#define ROOT_ENTRIES            (FILEIO_CONFIG_MEDIA_SECTOR_SIZE / ROOT_ENTRY_SIZE)
+#define FILE_OTHER              0xFE    // sector of a file/directory not parsed 
+#define FILE_UNKNOWN            0xFF    // sector not allocated (yet)
+
 
 #define DATEH(y, m, d)    (((y-1980) << 1) + (m >> 3))  // y:1980..2099, m:1..12
 #define DATEL(y, m, d)    ((m << 5) + d)                // d: 1..31
@@ -65,11 +124,31 @@ void FATRecordSet( uint8_t* buffer, uint8_t seg);
 void RootRecordGet( uint8_t* buffer, uint8_t seg);
 
 /**
- * 
+ * Locate a data sector in the files written by the host (FAT and root)
+ * @param sector_addr   sector written
+ * @param position      (image files) index of the sector in the file
+ * @return  root entry of the image holding the sector, FILE_OTHER or FILE_UNKNOWN
+ */
+uint8_t FileSectorLocate( uint32_t sector_addr, uint8_t *position);
+
+/**
+ * Inspects the directory entries written by the host, to detect the format 
+ * of the file being copied (by extension) and the session control file
  * @param buffer
  */
 void RootRecordSet( uint8_t* buffer, uint8_t seg);
 
+#if DIRECT_READBACK
+/**
+ * Produces a segment of the readback files (READ.HEX, FLASH.BIN) reading the
+ * target, other sectors are left untouched 
+ */
+void DIRECT_ReadbackGet( uint32_t sector_addr, uint8_t *buffer, uint8_t seg);
+#endif
+/**
+ * Produces a segment of the verify-only session report (VERIFY.TXT)
+ */
+void DIRECT_ReportGet( uint8_t *buffer, uint8_t seg);
 /**
  * Initializes the ROOT directory in RAM
  */
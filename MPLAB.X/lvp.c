@@ -3,7 +3,8 @@ Copyright 2016 Microchip Technology Inc. (www.microchip.com)
 
  Low Voltage Programming Interface 
  
-  Bit-Banged implementation of the PIC16F1 (250K) LVP protocol
+  Bit-Banged implementation of the PIC16F1 LVP protocols, the 8-bit (250K) 
+  driver is here, the 6-bit (200K) driver in lvp-200.c 
   Based on the PIC16F188XX specification
   
 Licensed under the Apache License, Version 2.0 (the "License");
@@ -23,17 +24,16 @@ limitations under the License.
 #include "lvp.h"
 #include "leds.h"
 
-#define  CMD_LOAD_ADDRESS     0x80
-#define  CMD_LATCH_DATA       0x00
-#define  CMD_LATCH_DATA_IA    0x02
-#define  CMD_INC_ADDR         0xF8
-#define  CMD_BEGIN_PROG       0xE0
-#define  CMD_BULK_ERASE       0x18
+#define  REVISION_ID          0x8005
+#define  DEVICE_ID            0x8006
+#define  CAL_READS            4     // consistent reads required at each speed
 
 
+uint8_t lvp_mismatch;           // sockets read differently from the reference
+
 void ICSP_Init(void )
 {
-    ICSP_TRIS_DAT  = INPUT_PIN;
+    ICSP_DAT_INPUT();
     ICSP_CLK       = 0;
     ICSP_TRIS_CLK  = OUTPUT_PIN;
     ICSP_nMCLR = SLAVE_RUN;
@@ -42,7 +42,7 @@ void ICSP_Init(void )
 
 void ICSP_Release( void)
 {
-    ICSP_TRIS_DAT  = INPUT_PIN;
+    ICSP_DAT_INPUT();
     ICSP_TRIS_CLK  = INPUT_PIN;
     ICSP_nMCLR = SLAVE_RUN;     
     ICSP_TRIS_nMCLR = OUTPUT_PIN;
@@ -50,92 +50,625 @@ void ICSP_Release( void)
     LED_On(GREEN_LED);
 }
 
-void sendCmd(uint8_t b)
+/*******************************************************************************
+ Shift Kernels
+ 
+ One kernel pair per speed profile, unrolled and with the port values of both 
+ data levels (clock high) precomputed, so that each bit is a single LATB write
+ followed by the clock falling edge (data is latched by the target on it)
+ - FAST     close to the datasheet minimum (TCKH, TCKL >= 100ns) 
+ - NORMAL   about 250ns per clock phase
+ - SAFE     1us per clock phase, for long cables and heavy target loads 
+ ******************************************************************************/
+#define DELAY_FAST      NOP()
+#define DELAY_NORMAL    _delay(3)
+#define DELAY_SAFE      __delay_us(1)
+
+#define OUT_BIT( b, m, DELAY) \
+    ICSP_LAT = ((b) & (m)) ? hi1 : hi0; DELAY; ICSP_CLK = 0; DELAY;
+
+#define IN_BIT( b, m, DELAY) \
+    ICSP_CLK = 1; DELAY; ICSP_SAMPLE( b, m) ICSP_CLK = 0; DELAY;
+
+#define SHIFT_KERNELS( name, DELAY) \
+static void name##Out( uint8_t b) \
+{ \
+    uint8_t hi0, hi1; \
+    hi0 = (ICSP_LAT & ~LVP_GANG_MASK) | ICSP_CLK_MASK; \
+    hi1 = hi0 | LVP_GANG_MASK; \
+    OUT_BIT( b, 0x80, DELAY) OUT_BIT( b, 0x40, DELAY) \
+    OUT_BIT( b, 0x20, DELAY) OUT_BIT( b, 0x10, DELAY) \
+    OUT_BIT( b, 0x08, DELAY) OUT_BIT( b, 0x04, DELAY) \
+    OUT_BIT( b, 0x02, DELAY) OUT_BIT( b, 0x01, DELAY) \
+} \
+static uint8_t name##In( void) \
+{ \
+    uint8_t b = 0; \
+    IN_BIT( b, 0x80, DELAY) IN_BIT( b, 0x40, DELAY) \
+    IN_BIT( b, 0x20, DELAY) IN_BIT( b, 0x10, DELAY) \
+    IN_BIT( b, 0x08, DELAY) IN_BIT( b, 0x04, DELAY) \
+    IN_BIT( b, 0x02, DELAY) IN_BIT( b, 0x01, DELAY) \
+    return b; \
+}
+
+SHIFT_KERNELS( fast, DELAY_FAST)
+SHIFT_KERNELS( normal, DELAY_NORMAL)
+SHIFT_KERNELS( safe, DELAY_SAFE)
+
+static LVP_SPEED speed = LVP_SPEED_DEFAULT;
+static LVP_CALIBRATION cal;     // kept until the next detach
+
+/*******************************************************************************
+ 8-bit Command Set (250K)
+ ******************************************************************************/
+static const LVP_COMMANDS cmds8 = {
+    0x80,           // load address
+    LVP_CMD_NONE,   // load config (load address 0x8000 instead)
+    LVP_CMD_NONE,   // reset address 
+    0xF8,           // increment address
+    0x00,           // load latch
+    0x02,           // load latch and increment
+    0xFC,           // read
+    0xFE,           // read and increment
+    0xE0,           // begin internally timed programming
+    0xC0,           // begin externally timed programming
+    0x82,           // end externally timed programming
+    0x18,           // bulk erase
+    0xF0            // row erase
+};
+
+static void outByte( uint8_t b)
+{
+    switch( speed) {
+        case LVP_SPEED_FAST:    fastOut( b); break;
+        case LVP_SPEED_NORMAL:  normalOut( b); break;
+        default:                safeOut( b); break;
+    }
+}
+
+static uint8_t inByte( void)
+{
+    switch( speed) {
+        case LVP_SPEED_FAST:    return fastIn();
+        case LVP_SPEED_NORMAL:  return normalIn();
+        default:                return safeIn();
+    }
+}
+
+static void sendCmd( uint8_t b)
 {   
-    uint8_t i;
-    ICSP_TRIS_DAT = OUTPUT_PIN; 
-    for( i=0; i<8; i++){
-        if ((b & 0x80) > 0)
-            ICSP_DAT = 1;     // Msb first
-        else
-            ICSP_DAT = 0;     // Msb first
-        ICSP_CLK = 1;
-        b <<= 1;
-        __delay_us(1);
-        ICSP_CLK = 0;
-        __delay_us(1);
-    }    
-    __delay_us(1);
-}
-
-void sendData( uint16_t data)
+    ICSP_DAT_OUTPUT(); 
+    outByte( b);                // Msb first
+    __delay_us(1);              // TDLY
+}
+
+static void sendData( uint16_t data)
 {
-    uint8_t i;
-    uint24_t w = (uint24_t)data;
-    
-    w = (w <<1) & 0x7ffffe;     // add start and stop bits
-    ICSP_TRIS_DAT = OUTPUT_PIN; 
-    for( i=0; i < 24; i++){
-        if ((w & 0x800000) > 0) // Msb first
-            ICSP_DAT = 1;       
-        else
-            ICSP_DAT = 0;       
-        ICSP_CLK = 1;
-        w <<= 1;
-        __delay_us(1);
-        ICSP_CLK = 0;
-        __delay_us(1);
-    }    
-}
-
-uint8_t getByte( void)
-{
-    uint8_t i, b;
-    ICSP_TRIS_DAT = INPUT_PIN;  
-    for( i=0; i < 8; i++){
-        ICSP_CLK = 1;
-        b <<= 1;
-        __delay_us(1);
-        b |= ICSP_DAT;
-        ICSP_CLK = 0;
-        __delay_us(1);
-    }    
-    return b;
-}
-
-uint16_t getData( void)
+    // 24-bit payload: 7 x '0', 16 data bits, stop bit, Msb first
+    ICSP_DAT_OUTPUT(); 
+    outByte( (uint8_t)(data >> 15));
+    outByte( (uint8_t)(data >> 7));
+    outByte( (uint8_t)(data << 1));
+}
+
+static uint16_t getData( void)
+{
+    uint8_t b2, b1, b0;
+    ICSP_DAT_INPUT();  
+    b2 = inByte();
+    b1 = inByte();
+    b0 = inByte();
+    return ((uint16_t)b2 << 15) | ((uint16_t)b1 << 7) | (b0 >> 1);
+}
+
+static void sendKey( void)
+{
+    sendCmd( 'M');              // "MCHP" Msb first
+    sendCmd( 'C');
+    sendCmd( 'H');
+    sendCmd( 'P');
+}
+
+const LVP_DRIVER lvp8Driver = { sendKey, sendCmd, sendData, getData, &cmds8};
+
+/*******************************************************************************
+ Devices 
+ 
+ Row size, config layout and timing per device (in us). Internally timed 
+ cycles (programming, erase) are not polled and wait the datasheet maximum, 
+ externally timed programming waits the minimum TPEXT (busy, so that the end 
+ command cannot pass the TPEXT maximum), the entry waits 
+ include the settling of the board nMCLR circuit. The device ID is read when 
+ entering programming mode, the first entry of each family is used for 
+ unknown devices and until the ID is known. Rows are erased one by one 
+ (patch/differential programming) only if the row size is known for sure.
+ Config bits outside the mask are not implemented and read 1, they are not 
+ compared when the config words are updated without a bulk erase
+ ******************************************************************************/
+static const LVP_DEVICE devices[] = {
+//    id      mask    family           row flash   cfg     n  row_erase
+//       enter  key   tpint tpcfg tpext tdis terab terar
+//       implemented config bits (all of them for the family defaults)
+    { 0x0000, 0x0000, LVP_FAMILY_8BIT, 32, 0x8000, 0x8007, 5, true,     // PIC16F1xxxx
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x3FFF, 0x3FFF, 0x3FFF, 0x3FFF, 0x3FFF}},
+    { 0x306A, 0x3FFE, LVP_FAMILY_8BIT, 32, 0x1000, 0x8007, 5, true,     // PIC16(L)F18854
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}},
+    { 0x306C, 0x3FFE, LVP_FAMILY_8BIT, 32, 0x2000, 0x8007, 5, true,     // PIC16(L)F18855
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}},
+    { 0x306E, 0x3FFE, LVP_FAMILY_8BIT, 32, 0x2000, 0x8007, 5, true,     // PIC16(L)F18875
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}},
+    { 0x3070, 0x3FFE, LVP_FAMILY_8BIT, 32, 0x4000, 0x8007, 5, true,     // PIC16(L)F18856
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}},
+    { 0x3072, 0x3FFE, LVP_FAMILY_8BIT, 32, 0x4000, 0x8007, 5, true,     // PIC16(L)F18876
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}},
+    { 0x3074, 0x3FFE, LVP_FAMILY_8BIT, 32, 0x8000, 0x8007, 5, true,     // PIC16(L)F18857
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}},
+    { 0x3076, 0x3FFE, LVP_FAMILY_8BIT, 32, 0x8000, 0x8007, 5, true,     // PIC16(L)F18877
+        {10000, 5000, 2800, 5600, 1000, 300, 8400, 2800},
+        {0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}},
+    // smallest row of the family (16 latches), bulk erase only, the waits
+    // cover the slowest devices of the family
+    { 0x0000, 0x0000, LVP_FAMILY_6BIT, 16, 0x8000, 0x8007, 2, false,    // PIC16F1xxx
+        {10000, 5000, 3000, 6000, 1000, 300, 6000, 3000},
+        {0x3FFF, 0x3FFF}},
+    // PIC16(L)F145x and PIC16(L)F170x: the revision is read from 0x8005, the 
+    // ID word is compared whole (the mask merges the F and LF parts)
+    { 0x3020, 0x3FFB, LVP_FAMILY_6BIT, 32, 0x2000, 0x8007, 2, true,     // PIC16(L)F1454
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3FF3}},
+    { 0x3021, 0x3FFB, LVP_FAMILY_6BIT, 32, 0x2000, 0x8007, 2, true,     // PIC16(L)F1455
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3FF3}},
+    { 0x3023, 0x3FFB, LVP_FAMILY_6BIT, 32, 0x2000, 0x8007, 2, true,     // PIC16(L)F1459
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3FF3}},
+    { 0x3043, 0x3FFF, LVP_FAMILY_6BIT, 32, 0x1000, 0x8007, 2, true,     // PIC16F1704
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3F87}},
+    { 0x3045, 0x3FFF, LVP_FAMILY_6BIT, 32, 0x1000, 0x8007, 2, true,     // PIC16LF1704
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3F87}},
+    { 0x3042, 0x3FFF, LVP_FAMILY_6BIT, 32, 0x1000, 0x8007, 2, true,     // PIC16F1708
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3F87}},
+    { 0x3044, 0x3FFF, LVP_FAMILY_6BIT, 32, 0x1000, 0x8007, 2, true,     // PIC16LF1708
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3F87}},
+    { 0x3055, 0x3FFD, LVP_FAMILY_6BIT, 32, 0x2000, 0x8007, 2, true,     // PIC16(L)F1705
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3F87}},
+    { 0x3054, 0x3FFD, LVP_FAMILY_6BIT, 32, 0x2000, 0x8007, 2, true,     // PIC16(L)F1709
+        {10000, 5000, 2500, 5000, 1000, 300, 5000, 2500},
+        {0x3EFF, 0x3F87}},
+};
+
+static const LVP_DRIVER *drivers[ LVP_FAMILIES] = { &lvp8Driver, &lvp6Driver};
+
+static const LVP_DEVICE *device = devices;
+static const LVP_DRIVER *drv = &lvp8Driver;
+static const LVP_COMMANDS *cmds = &cmds8;
+static uint8_t family = LVP_FAMILY_8BIT;
+static uint16_t cursor;         // target PC (as last moved)
+static uint16_t target;         // PC required by the next command (see seek)
+static uint32_t commands;       // commands sent since entering programming mode
+static bool external = LVP_EXTERNAL_TIMING;
+
+/**
+ * Find the descriptor of a device 
+ * @param f     protocol family
+ * @param id    device ID word (0 = family default)
+ */
+static const LVP_DEVICE * deviceFind( uint8_t f, uint16_t id)
+{
+    const LVP_DEVICE *d, *found = 0;
+    for( d = devices; d < &devices[ sizeof(devices)/sizeof(LVP_DEVICE)]; d++) {
+        if (d->family != f) continue;
+        if (found == 0) found = d;          // default
+        if ((d->id != 0) && ((id & d->id_mask) == d->id)) return d;
+    }
+    return found;
+}
+
+const LVP_DEVICE * LVP_deviceGet( void)
+{
+    return device;
+}
+
+/**
+ * Select the programming method of program memory rows
+ * @param ext   true = externally timed (shorter), false = internally timed
+ */
+void LVP_externalTimingSet( bool ext)
+{
+    external = ext;
+}
+
+const LVP_TIMING * LVP_timingGet( void)
+{
+    return &device->timing;
+}
+
+void LVP_speedSet( LVP_SPEED s)
+{
+    speed = s;
+}
+
+LVP_SPEED LVP_speedGet( void)
+{
+    return speed;
+}
+
+/*******************************************************************************
+ Engine 
+ 
+ Programming and erase cycles are started and timed by a hardware timer, the 
+ functions return immediately and the cycle is completed by LVP_tasks (from 
+ the main loop) so that USB and UART keep being serviced in the meantime. 
+ Externally timed programming is the exception: its end must be sent within 
+ the TPEXT window, so the pulse is timed busy and only the discharge runs in 
+ the background. Any new operation waits first for the completion of the 
+ previous one
+ ******************************************************************************/
+enum lvpstate { LVP_IDLE, LVP_PROG, LVP_DISCHARGE, LVP_ERASE};
+
+#define LVP_LOAD_COST   4   // cost of a command with payload, in increments
+
+static uint8_t state = LVP_IDLE;
+static bool inc_after;          // increment the address at the end of the cycle
+static LVP_CALLBACK done;       // completion callback 
+
+static void timerStart( uint16_t us)
+{
+    uint16_t t = 0 - (uint16_t)LVP_TMR_TICKS( us);
+    LVP_TMR_CON = LVP_TMR_CONFIG;           // stopped
+    LVP_TMR_H = t >> 8;                     // (buffered until TMRL is written)
+    LVP_TMR_L = t & 0xff;
+    LVP_TMR_IF = 0;
+    LVP_TMR_CON = LVP_TMR_CONFIG | 1;       // on
+}
+
+/**
+ * Blocking wait (entering programming mode, externally timed programming)
+ */
+static void delayUs( uint16_t us)
+{
+    timerStart( us);
+    while( !LVP_TMR_IF);
+}
+
+/**
+ * Send a command (counted)
+ */
+static void command( uint8_t cmd)
+{
+    drv->cmd( cmd);
+    commands++;
+}
+
+/**
+ * Move to the next address, the increment is sent only when a command 
+ * depending on the PC follows (see seek)
+ */
+static void incAddress( void)
+{
+    target++;
+}
+
+/**
+ * Set the target PC, the move is deferred to the next command depending on
+ * it so that consecutive moves (and increments) are merged 
+ */
+static void moveTo( uint16_t address)
+{
+    target = address;
+}
+
+/**
+ * Bring the target PC to the address required with the fewest commands: 
+ * increments from the current address (same memory space, forward only) or
+ * a jump, i.e. a load address when available, otherwise a reset to 0 or to 
+ * the config space followed by increments (costs counted in increments, a 
+ * command with payload counting as LVP_LOAD_COST)
+ */
+static void seek( void)
+{
+    uint16_t base, jump, walk = 0xffff;
+    bool cfg = (target >= LVP_CFG_SPACE);
+
+    if (target == cursor) return;
+    if ((target > cursor) && (cfg == (cursor >= LVP_CFG_SPACE)))
+        walk = target - cursor;
+    if (cmds->load_address != LVP_CMD_NONE) {
+        base = target;
+        jump = LVP_LOAD_COST;
+    }
+    else if (cfg) {
+        base = LVP_CFG_SPACE;
+        jump = LVP_LOAD_COST + (target - base);
+    }
+    else {
+        base = 0;
+        jump = 1 + target;
+    }
+    if (jump < walk) {
+        if (cmds->load_address != LVP_CMD_NONE) {
+            command( cmds->load_address);  
+            drv->data( base);
+        }
+        else if (cfg) {
+            command( cmds->load_config);
+            drv->data( 0x3fff);
+        }
+        else 
+            command( cmds->reset_address);
+        cursor = base;
+    }
+    for(; cursor < target; cursor++) 
+        command( cmds->inc_address);
+}
+
+void LVP_callbackSet( LVP_CALLBACK cb)
+{
+    done = cb;
+}
+
+/**
+ * Advance the current cycle when its time has elapsed
+ */
+void LVP_tasks( void)
+{
+    if ((state == LVP_IDLE) || !LVP_TMR_IF) return;
+    switch( state) {
+        case LVP_PROG:
+        case LVP_DISCHARGE:
+            if (inc_after) incAddress();
+            break;
+        default:
+            break;
+    }
+    state = LVP_IDLE;
+    if (done) done();
+}
+
+bool LVP_busy( void)
+{
+    LVP_tasks();
+    return (state != LVP_IDLE);
+}
+
+void LVP_wait( void)
+{
+    while( LVP_busy());
+}
+
+/**
+ * Start a programming cycle of the latches, the address is incremented at 
+ * its completion
+ */
+static void program( bool cfg)
+{
+    inc_after = true;
+    if (external && !cfg) {     // not supported for config words 
+        command( cmds->begin_ext);
+        delayUs( device->timing.tpext);
+        command( cmds->end_ext);
+        state = LVP_DISCHARGE;
+        timerStart( device->timing.tdis);
+    }
+    else {
+        command( cmds->begin_int);
+        state = LVP_PROG;
+        timerStart( cfg ? device->timing.tpcfg : device->timing.tpint);
+    }
+}
+
+/**
+ * Start an erase cycle 
+ */
+static void erase( uint8_t cmd, uint16_t us)
+{
+    seek();
+    command( cmd);
+    inc_after = false;
+    state = LVP_ERASE;
+    timerStart( us);
+}
+
+void LVP_addressLoad( uint16_t address)
+{
+    LVP_wait();
+    moveTo( address);
+}
+
+/**
+ * Test if moving to a program memory address is a jump from 0 (no load 
+ * address command: reset and increments, the cost grows with the address)
+ */
+bool LVP_seekBack( uint16_t address)
+{
+    return (cmds->load_address == LVP_CMD_NONE) && (address < LVP_CFG_SPACE) &&
+            ((address < cursor) || (cursor >= LVP_CFG_SPACE));
+}
+
+void LVP_skip( uint16_t count)
+{
+    LVP_wait();
+    target += count;
+}
+
+/**
+ * Read a word from the target (program memory or config space)
+ */
+uint16_t LVP_read( uint16_t address)
+{
+    LVP_wait();
+    moveTo( address);
+    seek();
+    command( cmds->read);
+    return drv->get();
+}
+
+/**
+ * Read the word at the current address and move to the next one
+ */
+uint16_t LVP_readNext( void)
+{
+    uint16_t w;
+    LVP_wait();
+    if (cmds->read_inc != LVP_CMD_NONE) {
+        seek();
+        command( cmds->read_inc);
+        cursor++;
+        target++;
+        return drv->get();
+    }
+    seek();
+    command( cmds->read);
+    w = drv->get();
+    incAddress();
+    return w;
+}
+
+/**
+ * Read the device and revision ID repeatedly at the current speed
+ * @return  true if all reads match the reference values
+ */
+static bool calibrationPass( uint16_t id, uint16_t rev)
 {
     uint8_t i;
-    uint16_t w = 0;
-    ICSP_TRIS_DAT = INPUT_PIN;  
-    for( i=0; i < 24; i++){
-        ICSP_CLK = 1;
-        w <<= 1;
-        __delay_us(1);
-        w |= ICSP_DAT;
-        ICSP_CLK = 0;
-        __delay_us(1);
-    }    
-    return (w >> 1);
+    for( i=0; i<CAL_READS; i++) {
+        if (LVP_read( DEVICE_ID) != id) return false;
+        if (LVP_read( REVISION_ID) != rev) return false;
+    }
+    return (LVP_mismatchGet() & cal.sockets) == 0;  // (gang) all sockets
+}
+
+/**
+ * Pick the fastest speed profile, up to LVP_SPEED_DEFAULT, reading the device 
+ * ID consistently (the result is cached until LVP_calibrationReset)
+ * @return  false if no target responds (the safe profile is used)
+ */
+bool LVP_calibrate( void)
+{
+    uint16_t id, rev;
+    uint8_t  s;
+
+    if (cal.valid) {
+        speed = cal.speed;
+        return true;
+    }
+    speed = LVP_SPEED_SAFE;     // reference values at the slowest speed
+    cal.retries = 0;
+    cal.sockets = 0;
+    LVP_mismatchGet();
+    id  = LVP_read( DEVICE_ID);
+    rev = LVP_read( REVISION_ID);
+    cal.sockets = LVP_GANG_MASK & ~LVP_mismatchGet();   // sockets answering
+    if ((id == 0) || (id == 0x3fff) || !calibrationPass( id, rev)) {
+        cal.speed = speed;
+        return false;           // no (or no stable) target, do not cache
+    }
+    cal.speed = LVP_SPEED_SAFE;
+    for( s = LVP_SPEED_SAFE + 1; s <= LVP_SPEED_DEFAULT; s++) {
+        speed = (LVP_SPEED)s;
+        if (!calibrationPass( id, rev)) {
+            cal.retries++;      // give it a second chance
+            if (!calibrationPass( id, rev)) break;
+        }
+        cal.speed = (LVP_SPEED)s;   // reliable so far
+    }
+    speed = cal.speed;
+    cal.id = id;
+    cal.family = family;
+    cal.valid = true;
+    return true;
+}
+
+void LVP_calibrationReset( void)
+{
+    cal.valid = false;
+}
+
+const LVP_CALIBRATION * LVP_calibrationGet( void)
+{
+    return &cal;
+}
+
+/**
+ * Hold the target in reset and send the key sequence of a protocol family
+ */
+static void familyEnter( uint8_t f)
+{
+    family = f;
+    drv = drivers[ f];
+    cmds = drv->cmds;
+    device = deviceFind( f, 0);  // device not known yet
+    ICSP_nMCLR = SLAVE_RESET;    // MCLR = Vil (GND)
+    delayUs( device->timing.enter);
+    drv->key();
+    delayUs( device->timing.key);
+    cursor = target = 0;         // (PC reset on entry)
 }
 
+/**
+ * Enter programming mode, the protocol family is detected reading the device 
+ * ID with each key sequence in turn (cached with the calibration)
+ */
 void LVP_enter( void)
 {
+    uint8_t f;
+
     LED_On(RED_LED);
     LED_Off(GREEN_LED);
 
     ICSP_Init();                 // configure I/Os   
-    ICSP_nMCLR = SLAVE_RESET;    // MCLR = Vil (GND)
-    __delay_ms(10);
-    sendCmd( 'M');
-    sendCmd( 'C');
-    sendCmd( 'H');
-    sendCmd( 'P');
-    __delay_ms( 5);
+    commands = 0;
+    if (cal.valid) {
+        familyEnter( cal.family);
+        LVP_calibrate();
+    }
+    else {
+        for( f=0; f<LVP_FAMILIES; f++) {
+            familyEnter( f);
+            if (LVP_calibrate()) break;
+            ICSP_nMCLR = SLAVE_RUN;  // no answer, exit and try the next key 
+            delayUs( device->timing.key);
+        }
+        if (f == LVP_FAMILIES)   // no target, default 
+            familyEnter( LVP_FAMILY_8BIT);
+    }
+    device = deviceFind( family, cal.id);
+}
+
+/**
+ * Sockets (DAT lines) read differently from the reference socket since the 
+ * previous call (gang programming)
+ */
+uint8_t LVP_mismatchGet( void)
+{
+    uint8_t m = lvp_mismatch;
+    lvp_mismatch = 0;
+    return m;
+}
+
+/**
+ * Commands sent since entering programming mode (cost of the session)
+ */
+uint32_t LVP_commandsGet( void)
+{
+    return commands;
 }
 
 void LVP_exit( void)
 {
+    LVP_wait();
     ICSP_Release();             // release ICSP-DAT and ICSP-CLK
 }
 
@@ -146,50 +679,53 @@ bool LVP_inProgress( void)
 
 void LVP_bulkErase( void)
 {
-    sendCmd( CMD_LOAD_ADDRESS);  // enter config area to erase config words too
-    sendData( 0x8000);
-    sendCmd( CMD_BULK_ERASE);
-    __delay_ms( 6);
-}
-
-void LVP_skip(uint16_t count)
-{
-    while(count-- > 0){
-        sendCmd( CMD_INC_ADDR);     // increment address     
-    }
+    LVP_wait();
+    moveTo( LVP_CFG_SPACE);     // enter config area to erase config words too
+    erase( cmds->bulk_erase, device->timing.terab);
 }
 
-void LVP_addressLoad( uint16_t address)
+void LVP_rowErase( uint16_t address)
 {
-    sendCmd( CMD_LOAD_ADDRESS);  
-    sendData( address);    
+    LVP_wait();
+    moveTo( address);
+    erase( cmds->row_erase, device->timing.terar);
 }
 
 void LVP_rowWrite( uint16_t *buffer, uint8_t w)
 {   
+    LVP_wait();
     for(; w>1; w--)     // load n-1 latches 
     {
-        sendCmd( CMD_LATCH_DATA_IA);
-        sendData( *buffer++);
+        if (cmds->latch_inc != LVP_CMD_NONE) {
+            seek();
+            command( cmds->latch_inc);
+            drv->data( *buffer++);
+            cursor++;
+            target++;
+        }
+        else {
+            seek();
+            command( cmds->latch);
+            drv->data( *buffer++);
+            incAddress();
+        }
     }
-    sendCmd( CMD_LATCH_DATA);   // load last latch (n-1)
-    sendData( *buffer++);
-    sendCmd( CMD_BEGIN_PROG);   
-    __delay_ms( 3);
-    sendCmd( CMD_INC_ADDR);     // increment address only after prog. command!
+    seek();
+    command( cmds->latch);     // load last latch (n-1)
+    drv->data( *buffer++);
+    program( false);            // (address incremented only after prog. cycle)
 }
 
 void LVP_cfgWrite( uint16_t *cfg, uint8_t count)
 {
-    sendCmd( CMD_LOAD_ADDRESS); 
-    sendData(0x8007 );
+    LVP_wait();
+    moveTo( device->cfg_address); 
     while( count-- > 0){
-        sendCmd( CMD_LATCH_DATA);
-        sendData( *cfg++);
-        sendCmd( CMD_BEGIN_PROG);
-        __delay_ms( 3);
-        sendCmd( CMD_INC_ADDR);    
-    }
-    sendCmd( CMD_LOAD_ADDRESS);   // enter code area 
-    sendData(0x0000);
+        seek();
+        command( cmds->latch);
+        drv->data( *cfg++);
+        program( true);
+        LVP_wait();
+    }
+    moveTo( 0);                 // enter code area 
 }
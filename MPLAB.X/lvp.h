@@ -31,21 +31,172 @@ limitations under the License.
 
 #define ICSP_TRIS_DAT       TRISBbits.TRISB3
 #define ICSP_DAT            LATBbits.LATB3
+#define ICSP_DAT_IN         PORTBbits.RB3
 #define ICSP_TRIS_CLK       TRISBbits.TRISB2
 #define ICSP_CLK            LATBbits.LATB2
+#define ICSP_LAT            LATB            // port of DAT and CLK
+#define ICSP_DAT_MASK       0x08
+#define ICSP_CLK_MASK       0x04
+#define ICSP_PORT           PORTB           // DAT lines (input)
+#define ICSP_TRIS           TRISB           // DAT lines (direction)
 #define ICSP_TRIS_nMCLR     TRISBbits.TRISB4
 #define ICSP_nMCLR          LATBbits.LATB4
 
+// gang programming: DAT lines (ICSP_PORT bits) of the sockets programmed in 
+// parallel, sharing CLK and nMCLR (e.g. 0xCA = RB1, RB3, RB6, RB7). All the
+// targets receive the same command stream, ICSP_DAT is the reference socket
+// whose reads are returned, the other sockets are compared with it 
+#if !defined(LVP_GANG_MASK)
+    #define LVP_GANG_MASK   ICSP_DAT_MASK
+#endif
+#define ICSP_DAT_OUTPUT()   ICSP_TRIS &= ~LVP_GANG_MASK
+#define ICSP_DAT_INPUT()    ICSP_TRIS |= LVP_GANG_MASK
+
+// sample the DAT lines (clock high): the reference bit is or-ed in b, the 
+// sockets reading a different level are collected in lvp_mismatch
+#if (LVP_GANG_MASK == ICSP_DAT_MASK)
+    #define ICSP_SAMPLE( b, m)  if (ICSP_DAT_IN) b |= (m);
+#else
+    #define ICSP_SAMPLE( b, m)  { uint8_t s_ = ICSP_PORT & LVP_GANG_MASK; \
+        if (s_ & ICSP_DAT_MASK) { b |= (m); s_ ^= LVP_GANG_MASK; } lvp_mismatch |= s_; }
+#endif
+extern uint8_t lvp_mismatch;    // lvp.c
+
+// timer used to time the programming cycles (Fosc/4, 1:8 prescaler, 16-bit)
+#define LVP_TMR_CON         T1CON
+#define LVP_TMR_H           TMR1H
+#define LVP_TMR_L           TMR1L
+#define LVP_TMR_IF          PIR1bits.TMR1IF
+#define LVP_TMR_CONFIG      0x32
+#define LVP_TMR_TICKS(us)   ((uint32_t)(us) * 3 / 2)    // 1.5MHz
+
 #define  LVP_init() LVP_exit();
 
+// ICSP clock speed profiles 
+typedef enum {
+    LVP_SPEED_SAFE,             // 1us per clock phase
+    LVP_SPEED_NORMAL,           // ~250ns per clock phase
+    LVP_SPEED_FAST              // close to the datasheet minimum
+} LVP_SPEED;
+
+// speed used and highest one tried by LVP_calibrate, the fast profile leaves
+// no margin to long or loaded ICSP lines and must be selected by the build
+#if !defined(LVP_SPEED_DEFAULT)
+    #define LVP_SPEED_DEFAULT LVP_SPEED_NORMAL
+#endif
+
+// program memory rows externally timed (0xC0/0x82) instead of internally (0xE0)
+#if !defined(LVP_EXTERNAL_TIMING)
+    #define LVP_EXTERNAL_TIMING false
+#endif
+
+// device timing (all values in us)
+typedef struct {
+    uint16_t  enter;            // nMCLR low to key sequence
+    uint16_t  key;              // key sequence to first command
+    uint16_t  tpint;            // internally timed programming, program memory
+    uint16_t  tpcfg;            // internally timed programming, config words
+    uint16_t  tpext;            // externally timed programming 
+    uint16_t  tdis;             // discharge after end of external programming 
+    uint16_t  terab;            // bulk erase
+    uint16_t  terar;            // row erase
+} LVP_TIMING;
+
+// ICSP protocol families (in autodetect order)
+typedef enum {
+    LVP_FAMILY_8BIT,            // 8-bit commands, 24-bit payload, Msb first (250K)
+    LVP_FAMILY_6BIT,            // 6-bit commands, 16-bit payload, Lsb first (200K)
+    LVP_FAMILIES
+} LVP_FAMILY;
+
+#define LVP_CMD_NONE        0xff    // command not available in the family
+#define LVP_CFG_SPACE       0x8000  // config space (user IDs, device ID, config words)
+#define LVP_ROW_MAX         64      // largest row supported (words)
+#define LVP_CFG_MAX         5       // largest number of config words supported
+
+// command set of a protocol family
+typedef struct {
+    uint8_t   load_address;     // load PC (none = relative addressing only)
+    uint8_t   load_config;      // PC = LVP_CFG_SPACE (and load a latch)
+    uint8_t   reset_address;    // PC = 0
+    uint8_t   inc_address;
+    uint8_t   latch;            // load a latch
+    uint8_t   latch_inc;        // load a latch and increment PC
+    uint8_t   read;
+    uint8_t   read_inc;         // read and increment PC
+    uint8_t   begin_int;        // internally timed programming
+    uint8_t   begin_ext;        // externally timed programming
+    uint8_t   end_ext;
+    uint8_t   bulk_erase;
+    uint8_t   row_erase;
+} LVP_COMMANDS;
+
+// bit level driver of a protocol family 
+typedef struct {
+    void      (*key)( void);    // key sequence (nMCLR low)
+    void      (*cmd)( uint8_t cmd);
+    void      (*data)( uint16_t data);      // payload (program word)
+    uint16_t  (*get)( void);                // read payload (program word)
+    const LVP_COMMANDS *cmds;
+} LVP_DRIVER;
+
+// device descriptor, the first entry of each family is its default (unknown 
+// devices and before the device ID is known)
+typedef struct {
+    uint16_t  id;               // device ID (0 = default of the family)
+    uint16_t  id_mask;          // bits of the ID word compared
+    uint8_t   family;           // LVP_FAMILY
+    uint8_t   row_size;         // words per row (write latches), up to LVP_ROW_MAX
+    uint16_t  flash_size;       // program memory (words)
+    uint16_t  cfg_address;      // first config word
+    uint8_t   cfg_num;          // number of config words, up to LVP_CFG_MAX
+    bool      row_erase;        // rows can be erased individually
+    LVP_TIMING timing;
+    uint16_t  cfg_mask[ LVP_CFG_MAX];   // implemented config bits (others read 1)
+} LVP_DEVICE;
+
+extern const LVP_DRIVER lvp8Driver;     // lvp.c
+extern const LVP_DRIVER lvp6Driver;     // lvp-200.c
+
+// result of the ICSP link calibration (see LVP_calibrate)
+typedef struct {
+    LVP_SPEED speed;            // fastest reliable speed profile
+    uint8_t   retries;          // passes repeated because of a read mismatch
+    uint16_t  id;               // device ID read 
+    uint8_t   family;           // protocol family detected
+    uint8_t   sockets;          // gang: DAT lines reading the same ID as ICSP_DAT
+    bool      valid;            // cached (until the next detach)
+} LVP_CALIBRATION;
+
 void LVP_enter( void);
 void LVP_exit( void);
 void LVP_addressLoad( uint16_t address);
+bool LVP_seekBack( uint16_t address);
 void LVP_bulkErase( void);
+void LVP_rowErase( uint16_t address);
 void LVP_skip( uint16_t count);
 bool LVP_inProgress(void);
 void LVP_rowWrite( uint16_t *buffer, uint8_t n);
 void LVP_cfgWrite( uint16_t *buffer, uint8_t n);
+void LVP_speedSet( LVP_SPEED s);
+LVP_SPEED LVP_speedGet( void);
+uint16_t LVP_read( uint16_t address);
+uint16_t LVP_readNext( void);
+bool LVP_calibrate( void);
+void LVP_calibrationReset( void);
+const LVP_CALIBRATION * LVP_calibrationGet( void);
+void LVP_externalTimingSet( bool ext);
+
+// programming/erase cycles complete in the background (see LVP_tasks)
+typedef void (*LVP_CALLBACK)( void);
+void LVP_callbackSet( LVP_CALLBACK cb);
+void LVP_tasks( void);
+bool LVP_busy( void);
+void LVP_wait( void);
+const LVP_TIMING * LVP_timingGet( void);
+const LVP_DEVICE * LVP_deviceGet( void);
+uint32_t LVP_commandsGet( void);
+uint8_t LVP_mismatchGet( void);
 
 #endif	/* LVP_H */
 
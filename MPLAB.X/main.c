@@ -36,6 +36,7 @@ limitations under the License.
 MAIN_RETURN main(void)
 {
     SYSTEM_Initialize();
+    DIRECT_Initialize();        // programming state machine (stream context)
 
     USBDeviceInit();
     USBDeviceAttach();
@@ -53,6 +54,7 @@ MAIN_RETURN main(void)
          * top of the while loop. */
         if( USBGetDeviceState() < CONFIGURED_STATE )
         {   /* USB connection not available or not yet complete */
+            LVP_calibrationReset();     // new fixture/target possible
             // implement nMCLR button 
             if ( BUTTON_IsPressed(BUTTON_S1)) {
                 ICSP_nMCLR = SLAVE_RESET;
@@ -85,6 +87,7 @@ MAIN_RETURN main(void)
             LED_Off(GREEN_LED);     // turn off RED LED to indicate ready for download
             LED_On (RED_LED);
             DIRECT_Initialize();    // reset the programming state machine
+            LVP_calibrationReset();
         }
         else { // simply act as a slave reset 
             LUNSoftAttach(0);                       // mark the media as available
@@ -98,6 +101,7 @@ MAIN_RETURN main(void)
         //Application specific tasks
         APP_DeviceMSDTasks();
         APP_DeviceCDCEmulatorTasks();
+        DIRECT_Tasks();                 // close programming sessions
 
     }//end while
 }//end main
@@ -133,6 +137,7 @@ bool USER_USB_CALLBACK_EVENT_HANDLER(USB_EVENT event, void *pdata, uint16_t size
             break;
 
         case EVENT_SOF:
+            DIRECT_Tick();              // 1ms time base
             break;
 
         case EVENT_SUSPEND:
@@ -51,17 +51,17 @@ OBJECTDIR=build/${CND_CONF}/${IMAGE_TYPE}
 DISTDIR=dist/${CND_CONF}/${IMAGE_TYPE}
 
 # Source Files Quoted if spaced
-SOURCEFILES_QUOTED_IF_SPACED=system_config/XPRESS/system.c main.c usb_descriptors.c app_device_msd.c files.c direct.c lvp.c app_device_cdc.c ../bsp/xpress/buttons.c ../bsp/xpress/leds.c ../bsp/xpress/uart.c ../framework/usb/src/usb_device.c ../framework/usb/src/usb_device_msd.c ../framework/usb/src/usb_device_cdc.c
+SOURCEFILES_QUOTED_IF_SPACED=system_config/XPRESS/system.c main.c usb_descriptors.c app_device_msd.c files.c direct.c lvp.c lvp-200.c app_device_cdc.c ../bsp/xpress/buttons.c ../bsp/xpress/leds.c ../bsp/xpress/uart.c ../framework/usb/src/usb_device.c ../framework/usb/src/usb_device_msd.c ../framework/usb/src/usb_device_cdc.c
 
 # Object Files Quoted if spaced
-OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/system_config/XPRESS/system.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/usb_descriptors.p1 ${OBJECTDIR}/app_device_msd.p1 ${OBJECTDIR}/files.p1 ${OBJECTDIR}/direct.p1 ${OBJECTDIR}/lvp.p1 ${OBJECTDIR}/app_device_cdc.p1 ${OBJECTDIR}/_ext/1371762614/buttons.p1 ${OBJECTDIR}/_ext/1371762614/leds.p1 ${OBJECTDIR}/_ext/1371762614/uart.p1 ${OBJECTDIR}/_ext/2142726457/usb_device.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_msd.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_cdc.p1
-POSSIBLE_DEPFILES=${OBJECTDIR}/system_config/XPRESS/system.p1.d ${OBJECTDIR}/main.p1.d ${OBJECTDIR}/usb_descriptors.p1.d ${OBJECTDIR}/app_device_msd.p1.d ${OBJECTDIR}/files.p1.d ${OBJECTDIR}/direct.p1.d ${OBJECTDIR}/lvp.p1.d ${OBJECTDIR}/app_device_cdc.p1.d ${OBJECTDIR}/_ext/1371762614/buttons.p1.d ${OBJECTDIR}/_ext/1371762614/leds.p1.d ${OBJECTDIR}/_ext/1371762614/uart.p1.d ${OBJECTDIR}/_ext/2142726457/usb_device.p1.d ${OBJECTDIR}/_ext/2142726457/usb_device_msd.p1.d ${OBJECTDIR}/_ext/2142726457/usb_device_cdc.p1.d
+OBJECTFILES_QUOTED_IF_SPACED=${OBJECTDIR}/system_config/XPRESS/system.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/usb_descriptors.p1 ${OBJECTDIR}/app_device_msd.p1 ${OBJECTDIR}/files.p1 ${OBJECTDIR}/direct.p1 ${OBJECTDIR}/lvp.p1 ${OBJECTDIR}/lvp-200.p1 ${OBJECTDIR}/app_device_cdc.p1 ${OBJECTDIR}/_ext/1371762614/buttons.p1 ${OBJECTDIR}/_ext/1371762614/leds.p1 ${OBJECTDIR}/_ext/1371762614/uart.p1 ${OBJECTDIR}/_ext/2142726457/usb_device.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_msd.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_cdc.p1
+POSSIBLE_DEPFILES=${OBJECTDIR}/system_config/XPRESS/system.p1.d ${OBJECTDIR}/main.p1.d ${OBJECTDIR}/usb_descriptors.p1.d ${OBJECTDIR}/app_device_msd.p1.d ${OBJECTDIR}/files.p1.d ${OBJECTDIR}/direct.p1.d ${OBJECTDIR}/lvp.p1.d ${OBJECTDIR}/lvp-200.p1.d ${OBJECTDIR}/app_device_cdc.p1.d ${OBJECTDIR}/_ext/1371762614/buttons.p1.d ${OBJECTDIR}/_ext/1371762614/leds.p1.d ${OBJECTDIR}/_ext/1371762614/uart.p1.d ${OBJECTDIR}/_ext/2142726457/usb_device.p1.d ${OBJECTDIR}/_ext/2142726457/usb_device_msd.p1.d ${OBJECTDIR}/_ext/2142726457/usb_device_cdc.p1.d
 
 # Object Files
-OBJECTFILES=${OBJECTDIR}/system_config/XPRESS/system.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/usb_descriptors.p1 ${OBJECTDIR}/app_device_msd.p1 ${OBJECTDIR}/files.p1 ${OBJECTDIR}/direct.p1 ${OBJECTDIR}/lvp.p1 ${OBJECTDIR}/app_device_cdc.p1 ${OBJECTDIR}/_ext/1371762614/buttons.p1 ${OBJECTDIR}/_ext/1371762614/leds.p1 ${OBJECTDIR}/_ext/1371762614/uart.p1 ${OBJECTDIR}/_ext/2142726457/usb_device.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_msd.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_cdc.p1
+OBJECTFILES=${OBJECTDIR}/system_config/XPRESS/system.p1 ${OBJECTDIR}/main.p1 ${OBJECTDIR}/usb_descriptors.p1 ${OBJECTDIR}/app_device_msd.p1 ${OBJECTDIR}/files.p1 ${OBJECTDIR}/direct.p1 ${OBJECTDIR}/lvp.p1 ${OBJECTDIR}/lvp-200.p1 ${OBJECTDIR}/app_device_cdc.p1 ${OBJECTDIR}/_ext/1371762614/buttons.p1 ${OBJECTDIR}/_ext/1371762614/leds.p1 ${OBJECTDIR}/_ext/1371762614/uart.p1 ${OBJECTDIR}/_ext/2142726457/usb_device.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_msd.p1 ${OBJECTDIR}/_ext/2142726457/usb_device_cdc.p1
 
 # Source Files
-SOURCEFILES=system_config/XPRESS/system.c main.c usb_descriptors.c app_device_msd.c files.c direct.c lvp.c app_device_cdc.c ../bsp/xpress/buttons.c ../bsp/xpress/leds.c ../bsp/xpress/uart.c ../framework/usb/src/usb_device.c ../framework/usb/src/usb_device_msd.c ../framework/usb/src/usb_device_cdc.c
+SOURCEFILES=system_config/XPRESS/system.c main.c usb_descriptors.c app_device_msd.c files.c direct.c lvp.c lvp-200.c app_device_cdc.c ../bsp/xpress/buttons.c ../bsp/xpress/leds.c ../bsp/xpress/uart.c ../framework/usb/src/usb_device.c ../framework/usb/src/usb_device_msd.c ../framework/usb/src/usb_device_cdc.c
 
 
 
@@ -144,6 +144,14 @@ ${OBJECTDIR}/lvp.p1: lvp.c  nbproject/Makefile-${CND_CONF}.mk
 	@-${MV} ${OBJECTDIR}/lvp.d ${OBJECTDIR}/lvp.p1.d 
 	@${FIXDEPS} ${OBJECTDIR}/lvp.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
 	
+${OBJECTDIR}/lvp-200.p1: lvp-200.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}" 
+	@${RM} ${OBJECTDIR}/lvp-200.p1.d 
+	@${RM} ${OBJECTDIR}/lvp-200.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c  -D__DEBUG=1  -mdebugger=none   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -maddrqual=require -xassembler-with-cpp -I"." -I"../framework/usb/inc" -I"../bsp/xpress" -I"system_config/xpress" -I"../framework" -I"../framework/fileio/inc" -mwarn=0 -Wa,-a -DXPRJ_XPRESS=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file -mcodeoffset=0x1000  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/lvp-200.p1 lvp-200.c 
+	@-${MV} ${OBJECTDIR}/lvp-200.d ${OBJECTDIR}/lvp-200.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/lvp-200.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+	
 ${OBJECTDIR}/app_device_cdc.p1: app_device_cdc.c  nbproject/Makefile-${CND_CONF}.mk 
 	@${MKDIR} "${OBJECTDIR}" 
 	@${RM} ${OBJECTDIR}/app_device_cdc.p1.d 
@@ -257,6 +265,14 @@ ${OBJECTDIR}/lvp.p1: lvp.c  nbproject/Makefile-${CND_CONF}.mk
 	@-${MV} ${OBJECTDIR}/lvp.d ${OBJECTDIR}/lvp.p1.d 
 	@${FIXDEPS} ${OBJECTDIR}/lvp.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
 	
+${OBJECTDIR}/lvp-200.p1: lvp-200.c  nbproject/Makefile-${CND_CONF}.mk 
+	@${MKDIR} "${OBJECTDIR}" 
+	@${RM} ${OBJECTDIR}/lvp-200.p1.d 
+	@${RM} ${OBJECTDIR}/lvp-200.p1 
+	${MP_CC} $(MP_EXTRA_CC_PRE) -mcpu=$(MP_PROCESSOR_OPTION) -c   -mdfp="${DFP_DIR}/xc8"  -fno-short-double -fno-short-float -memi=wordwrite -maddrqual=require -xassembler-with-cpp -I"." -I"../framework/usb/inc" -I"../bsp/xpress" -I"system_config/xpress" -I"../framework" -I"../framework/fileio/inc" -mwarn=0 -Wa,-a -DXPRJ_XPRESS=$(CND_CONF)  -msummary=-psect,-class,+mem,-hex,-file -mcodeoffset=0x1000  -ginhx32 -Wl,--data-init -mno-keep-startup -mno-download -mdefault-config-bits $(COMPARISON_BUILD)  -std=c99 -gdwarf-3 -mstack=compiled:auto:auto:auto     -o ${OBJECTDIR}/lvp-200.p1 lvp-200.c 
+	@-${MV} ${OBJECTDIR}/lvp-200.d ${OBJECTDIR}/lvp-200.p1.d 
+	@${FIXDEPS} ${OBJECTDIR}/lvp-200.p1.d $(SILENT) -rsi ${MP_CC_DIR}../  
+	
 ${OBJECTDIR}/app_device_cdc.p1: app_device_cdc.c  nbproject/Makefile-${CND_CONF}.mk 
 	@${MKDIR} "${OBJECTDIR}" 
 	@${RM} ${OBJECTDIR}/app_device_cdc.p1.d 
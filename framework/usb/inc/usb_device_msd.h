@@ -516,6 +516,10 @@ typedef struct
     uint8_t  (*AsyncWriteTasks)(void* config, void* pAsyncIO);
     // Function pointer to the async read tasks function of the physical media being used.
     uint8_t  (*AsyncReadTasks)(void* config, void* pAsyncIO);
+    // Function pointer to the SegmentBlank() function of the physical media 
+    //  being used: true if a segment reads as all zeros, it is then sent 
+    //  without calling SectorRead() (NULL = not supported).
+    uint8_t  (*SegmentBlank)(void * config, uint32_t sector_addr, uint8_t seg);
 } LUN_FUNCTIONS;
 
 /** Section: Externs *********************************************************/
@@ -231,9 +231,13 @@ please contact mla_licensing@microchip.com
         #define MSD_CSW_ADDR_TAG    __at(MSD_CSW_ADDRESS)
         #define MSD_BUFFER_ADDRESS  (MSD_CSW_ADDRESS+ MSD_OUT_EP_SIZE)
         #define MSD_BUFFER_ADDRESS_TAG      __at(MSD_BUFFER_ADDRESS)
+        #define MSD_BUFFER_OUT_ADDRESS  (MSD_BUFFER_ADDRESS+ MSD_OUT_EP_SIZE)   // second OUT (ping-pong) buffer
+        #define MSD_BUFFER_OUT_ADDRESS_TAG  __at(MSD_BUFFER_OUT_ADDRESS)
+        #define MSD_ZERO_ADDRESS    (MSD_BUFFER_OUT_ADDRESS+ MSD_OUT_EP_SIZE)   // blank IN packets (never written)
+        #define MSD_ZERO_ADDRESS_TAG        __at(MSD_ZERO_ADDRESS)
         #if defined (USB_USE_CDC)
             #define FIXED_ADDRESS_MEMORY
-            #define CDC_IN_DATA_BUFFER_ADDRESS      (MSD_BUFFER_ADDRESS + MSD_OUT_EP_SIZE)
+            #define CDC_IN_DATA_BUFFER_ADDRESS      (MSD_ZERO_ADDRESS + MSD_IN_EP_SIZE)
             #define CDC_OUT_DATA_BUFFER_ADDRESS     (CDC_IN_DATA_BUFFER_ADDRESS + CDC_DATA_IN_EP_SIZE)
             #define CDC_CONTROL_BUFFER_ADDRESS      (CDC_OUT_DATA_BUFFER_ADDRESS + CDC_DATA_OUT_EP_SIZE)
             #define CDC_IN_DATA_BUFFER_ADDRESS_TAG     __at(CDC_IN_DATA_BUFFER_ADDRESS)
@@ -42,6 +42,7 @@ extern LUN_FUNCTIONS LUN[MAX_LUN + 1];
 #define LUNSectorWrite(bLBA,pDest,seg)      LUN[LUN_INDEX].SectorWrite(LUN[LUN_INDEX].mediaParameters, bLBA, pDest, seg)
 #define LUNWriteProtectState()              LUN[LUN_INDEX].WriteProtectState(LUN[LUN_INDEX].mediaParameters)
 #define LUNSectorRead(bLBA,pSrc,seg)        LUN[LUN_INDEX].SectorRead(LUN[LUN_INDEX].mediaParameters, bLBA, pSrc, seg)
+#define LUNSegmentBlank(bLBA,seg)           ((LUN[LUN_INDEX].SegmentBlank != NULL) && LUN[LUN_INDEX].SegmentBlank(LUN[LUN_INDEX].mediaParameters, bLBA, seg))
 
 //Adjustable user options
 #define MSD_FAILED_READ_MAX_ATTEMPTS  (uint8_t)1u    //Used for error case handling
@@ -67,10 +68,27 @@ volatile USB_MSD_CSW msd_csw MSD_CSW_ADDR_TAG;  //Must be located in USB module
 
 #if defined(__18CXX) || defined(__XC8)
     volatile char msd_buffer[64] MSD_BUFFER_ADDRESS_TAG;
+    volatile char msd_buffer_out[64] MSD_BUFFER_OUT_ADDRESS_TAG;
+    volatile char msd_zero[64] MSD_ZERO_ADDRESS_TAG;
 #else
     volatile char msd_buffer[512];
+    volatile char msd_buffer_out[64];
+    volatile char msd_zero[64];
 #endif
 
+// WRITE10 data packets received ahead: with ping-pong buffering the next OUT 
+// packet is received (in the other buffer) while the current one is written
+#if (USB_PING_PONG_MODE == USB_PING_PONG__FULL_PING_PONG) || (USB_PING_PONG_MODE == USB_PING_PONG__ALL_BUT_EP0)
+    #define MSD_OUT_BUFFERS 2
+#else
+    #define MSD_OUT_BUFFERS 1
+#endif
+static volatile char * const msd_out[2] = { msd_buffer, msd_buffer_out};
+static USB_HANDLE msd_out_handle[2];    // packet armed in each buffer
+static uint8_t  msd_out_head;           // buffer of the oldest packet armed
+static uint8_t  msd_out_armed;          // packets armed (and not yet written)
+static uint32_t msd_out_left;           // packets of the command still to arm
+
 //State machine variables
 uint8_t MSD_State;			// Takes values MSD_WAIT, MSD_DATA_IN or MSD_DATA_OUT
 uint8_t MSDCommandState;
@@ -152,6 +170,8 @@ static void MSDComputeDeviceInAndResidue(uint16_t);
   ****************************************************************************/	
 void USBMSDInit(void)
 {
+    //Blank segments are all sent from the same buffer (only cleared here)
+    memset((void*)msd_zero, 0, sizeof(msd_zero));
     //Prepare to receive the first CBW
     USBMSDOutHandle = USBRxOnePacket(MSD_DATA_OUT_EP,(uint8_t*)&msd_cbw,MSD_OUT_EP_SIZE);
     //Initialize IN handle to point to first available IN MSD bulk endpoint entry
@@ -1106,8 +1126,14 @@ uint8_t MSDReadHandler(void)
                 break;
             }
             
+            ptrNextData=(uint8_t *)&msd_buffer[0];
+            if(LUNSegmentBlank(LBA.Val, segment))
+            {   // blank segments need no reading nor copying
+                ptrNextData=(uint8_t *)&msd_zero[0];
+                segment++;
+            }
             // get directly a packet of data from target !!!
-            if(LUNSectorRead(LBA.Val, (uint8_t*)&msd_buffer[0], segment++) != true)
+            else if(LUNSectorRead(LBA.Val, (uint8_t*)&msd_buffer[0], segment++) != true)
             {
                 //Read failed, no retries!!!
                 // we can't send the CSW immediately, since the host
@@ -1216,6 +1242,9 @@ uint8_t MSDWriteHandler(void)
                 MSDWriteState = MSD_WRITE10_WAIT;
                 return MSDWriteState;
             }
+            msd_out_left = TransferLength.Val * (uint32_t)(FILEIO_CONFIG_MEDIA_SECTOR_SIZE / MSD_OUT_EP_SIZE);
+            msd_out_armed = 0;
+            msd_out_head = 0;
         	
             MSD_State = MSD_WRITE10_BLOCK;
             //Fall through to MSD_WRITE10_BLOCK
@@ -1228,7 +1257,6 @@ uint8_t MSDWriteHandler(void)
             }
             
             MSDWriteState = MSD_WRITE10_RX_SECTOR;
-            ptrNextData=(uint8_t *)&msd_buffer[0];
               
             msd_csw.dCSWDataResidue=BLOCKLEN_512;
             segment = 0;    // !!!
@@ -1238,8 +1266,18 @@ uint8_t MSDWriteHandler(void)
         {
             if(msd_csw.dCSWDataResidue>0)
             {
-                if(USBHandleBusy(USBMSDOutHandle) == true) break;
-                USBMSDOutHandle = USBRxOnePacket(MSD_DATA_OUT_EP,ptrNextData,MSD_OUT_EP_SIZE);
+                // keep the free buffer(s) armed, never beyond the end of the
+                // command (the packet following it is the next CBW)
+                while((msd_out_armed < MSD_OUT_BUFFERS) && (msd_out_left > 0))
+                {
+                    if(USBHandleBusy(USBGetNextHandle(MSD_DATA_OUT_EP, OUT_FROM_HOST)) == true) break;
+                    ptrNextData = (uint8_t*)msd_out[ (msd_out_head + msd_out_armed) & 1];
+                    USBMSDOutHandle = USBRxOnePacket(MSD_DATA_OUT_EP,ptrNextData,MSD_OUT_EP_SIZE);
+                    msd_out_handle[ (msd_out_head + msd_out_armed) & 1] = USBMSDOutHandle;
+                    msd_out_armed++;
+                    msd_out_left--;
+                }
+                if(msd_out_armed == 0) break;
 
                 MSDWriteState = MSD_WRITE10_RX_PACKET;
                 //Fall through to MSD_WRITE10_RX_PACKET // do not!!!
@@ -1266,11 +1304,12 @@ uint8_t MSDWriteHandler(void)
         }
         //Fall through to MSD_WRITE10_RX_PACKET
         case MSD_WRITE10_RX_PACKET:
-            if(USBHandleBusy(USBMSDOutHandle) == true) break;
-            // immediately write the data to target !!!
+            if(USBHandleBusy(msd_out_handle[ msd_out_head]) == true) break;
+            // immediately write the data to target (the next packet is being
+            // received meanwhile) !!!
             if(msd_csw.bCSWStatus == 0x00)
             {   // notice the LBA.Val+1 !!!
-                if (LUNSectorWrite(LBA.Val+1, (uint8_t*)&msd_buffer[0], segment++) != true)
+                if (LUNSectorWrite(LBA.Val+1, (uint8_t*)msd_out[ msd_out_head], segment++) != true)
                 {   // if failed, communicate immediately, no retries!
                     msd_csw.bCSWStatus = MSD_CSW_COMMAND_FAILED;    // Indicate error during CSW phase
                     // Set error status sense keys, so the host can check them later
@@ -1279,9 +1318,10 @@ uint8_t MSDWriteHandler(void)
                     gblSenseData[LUN_INDEX].ASCQ = ASCQ_NO_ADDITIONAL_SENSE_INFORMATION;
                 }
             }
-            gblCBW.dCBWDataTransferLength-=USBHandleGetLength(USBMSDOutHandle);		// 64B read
-            msd_csw.dCSWDataResidue-=USBHandleGetLength(USBMSDOutHandle);
-//            ptrNextData += MSD_OUT_EP_SIZE; // keep the pointer fixed !!!
+            gblCBW.dCBWDataTransferLength-=USBHandleGetLength(msd_out_handle[ msd_out_head]);		// 64B read
+            msd_csw.dCSWDataResidue-=USBHandleGetLength(msd_out_handle[ msd_out_head]);
+            msd_out_head ^= (MSD_OUT_BUFFERS - 1);    // (buffers alternate)
+            msd_out_armed--;
             
             MSDWriteState = MSD_WRITE10_RX_SECTOR;
             break;
@@ -0,0 +1,223 @@
+/*******************************************************************************
+Copyright 2016 Microchip Technology Inc. (www.microchip.com)
+
+ Hex File Optimizer (host utility)
+
+  Rewrites an INTEL Hex file produced by the MPLAB XC8 compiler (or any other
+  toolchain) so that it is programmed with the least effort by the XPRESS
+  programmer (see direct.c):
+  - records are sorted in ascending address order
+  - each record covers (at most) one row and never crosses a row boundary,
+    completely filled rows become full-row records (fast path in direct.c)
+  - erased words are dropped (a record is split around blank runs when this
+    makes the file shorter)
+  The number of row programming cycles is estimated for both files by
+  replaying them through a model of the programmer row cache.
+
+  Build:   cc -O2 -o hexopt hexopt.c
+  Usage:   hexopt input.hex output.hex
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ROW_SIZE        32      // words, must match DIRECT_ROW_SIZE in the firmware
+#define CACHE_ROWS      3       // must match DIRECT_CACHE_ROWS in the firmware
+#define MEM_WORDS       0x10000 // 16-bit word address space
+#define BLANK_WORD      0x3FFF  // erased (14-bit) program word
+#define RECORD_COST     6       // bytes of record overhead (count, address, type, checksum)
+
+static uint16_t image[ MEM_WORDS];
+static bool     present[ MEM_WORDS];
+
+typedef struct {
+    long     bytes;             // file size
+    unsigned records;           // data records
+    unsigned rows;              // estimated row programming cycles
+} HEX_STATS;
+
+// model of the firmware row cache (LRU)
+static uint32_t cache[ CACHE_ROWS];
+static unsigned cache_used[ CACHE_ROWS], cache_clock;
+
+static void cacheReset( void)
+{
+    int i;
+    for (i = 0; i < CACHE_ROWS; i++) cache[ i] = UINT32_MAX;
+}
+
+static void cacheTouch( uint32_t row, HEX_STATS *st)
+{
+    int i, lru = 0;
+    for (i = 0; i < CACHE_ROWS; i++) {
+        if (cache[ i] == row) { cache_used[ i] = ++cache_clock; return; }
+        if (cache_used[ i] < cache_used[ lru]) lru = i;
+    }
+    for (i = 0; i < CACHE_ROWS; i++)
+        if (cache[ i] == UINT32_MAX) break;
+    if (i == CACHE_ROWS) { i = lru; st->rows++; }   // eviction
+    cache[ i] = row;
+    cache_used[ i] = ++cache_clock;
+}
+
+static void cacheFlush( HEX_STATS *st)
+{
+    int i;
+    for (i = 0; i < CACHE_ROWS; i++)
+        if (cache[ i] != UINT32_MAX) st->rows++;
+    cacheReset();
+}
+
+static int hexByte( const char *s)
+{
+    int v;
+    if (sscanf( s, "%2x", &v) != 1) return -1;
+    return v;
+}
+
+/**
+ * Load an INTEL Hex file in the word image, replaying the row cache model
+ * @return  false on error
+ */
+static bool loadHex( const char *name, HEX_STATS *st)
+{
+    FILE *f = fopen( name, "r");
+    char line[ 600];
+    uint32_t ext = 0, addr, a;
+    int  n, i, type, b;
+    uint8_t sum;
+
+    if (f == NULL) { perror( name); return false; }
+    cacheReset();
+    while (fgets( line, sizeof(line), f)) {
+        st->bytes += strlen( line);
+        if (line[0] != ':') continue;
+        n = hexByte( &line[1]);
+        addr = (hexByte( &line[3]) << 8) + hexByte( &line[5]);
+        type = hexByte( &line[7]);
+        if ((n < 0) || (type < 0)) { fprintf( stderr, "invalid record: %s", line); fclose( f); return false; }
+        sum = n + (addr >> 8) + addr + type;
+        for (i = 0; i <= n; i++) {
+            b = hexByte( &line[ 9 + 2*i]);
+            if (b < 0) { fprintf( stderr, "invalid record: %s", line); fclose( f); return false; }
+            sum += b;
+            if ((i < n) && (type == 0)) {
+                a = ext + addr + i;
+                if ((a & ((ROW_SIZE * 2) - 1)) == 0 || (i == 0))
+                    cacheTouch( a / (ROW_SIZE * 2), st);
+                if ((a >> 1) >= MEM_WORDS) continue;
+                if (!present[ a >> 1]) image[ a >> 1] = 0xFFFF;
+                present[ a >> 1] = true;
+                if (a & 1) image[ a >> 1] = (image[ a >> 1] & 0x00FF) | (b << 8);
+                else       image[ a >> 1] = (image[ a >> 1] & 0xFF00) | b;
+            }
+            if ((i < n) && (type == 4))
+                ext = (i == 0) ? ((uint32_t)b << 24) : (ext | ((uint32_t)b << 16));
+        }
+        if (sum != 0) { fprintf( stderr, "checksum error: %s", line); fclose( f); return false; }
+        if (type == 0) st->records++;
+        if (type == 1) break;
+    }
+    fclose( f);
+    cacheFlush( st);
+    return true;
+}
+
+static bool isBlank( uint32_t a)
+{
+    return !present[ a] || ((image[ a] & BLANK_WORD) == BLANK_WORD);
+}
+
+static void putRecord( FILE *f, uint16_t addr, uint8_t type, const uint8_t *data, int n, HEX_STATS *st)
+{
+    uint8_t sum = n + (addr >> 8) + addr + type;
+    int i;
+    st->bytes += fprintf( f, ":%02X%04X%02X", n, addr, type);
+    for (i = 0; i < n; i++) {
+        st->bytes += fprintf( f, "%02X", data[ i]);
+        sum += data[ i];
+    }
+    st->bytes += fprintf( f, "%02X\r\n", (uint8_t)-sum);
+    if (type == 0) st->records++;
+}
+
+/**
+ * Output the words [a, e) as a data record
+ */
+static void putWords( FILE *f, uint32_t a, uint32_t e, HEX_STATS *st)
+{
+    uint8_t data[ ROW_SIZE * 2];
+    int n = 0;
+    uint16_t w;
+    for (; a < e; a++) {
+        w = present[ a] ? image[ a] : 0xFFFF;
+        data[ n++] = w & 0xFF;
+        data[ n++] = w >> 8;
+    }
+    putRecord( f, (uint16_t)((a - n/2) << 1), 0, data, n, st);
+}
+
+static bool saveHex( const char *name, HEX_STATS *st)
+{
+    FILE *f = fopen( name, "wb");
+    uint32_t row, a, s, e, ext = 0;
+    uint8_t  x[2];
+
+    if (f == NULL) { perror( name); return false; }
+    for (row = 0; row < MEM_WORDS; row += ROW_SIZE) {
+        // non-blank spans of the row, merged when the gap is cheaper than a record
+        for (a = row; (a < row + ROW_SIZE) && isBlank( a); a++);
+        if (a < row + ROW_SIZE) st->rows++;    // programmed once (records are in order)
+        if ((a < row + ROW_SIZE) && ((row & ~0x7FFF) != ext)) {    // 64K byte pages
+            ext = row & ~0x7FFF;
+            x[0] = 0; x[1] = ext >> 15;
+            putRecord( f, 0, 4, x, 2, st);
+        }
+        while (a < row + ROW_SIZE) {
+            s = a;
+            for (e = a; a < row + ROW_SIZE; a++) {
+                if (!isBlank( a)) e = a + 1;
+                else if ((a - e + 1) * 4 > RECORD_COST * 2) break;
+            }
+            putWords( f, s, e, st);
+            for (; (a < row + ROW_SIZE) && isBlank( a); a++);
+        }
+    }
+    putRecord( f, 0, 1, NULL, 0, st);
+    fclose( f);
+    return true;
+}
+
+int main( int argc, char *argv[])
+{
+    HEX_STATS in = { 0}, out = { 0};
+
+    if (argc != 3) {
+        fprintf( stderr, "usage: %s input.hex output.hex\n", argv[0]);
+        return 1;
+    }
+    if (!loadHex( argv[1], &in)) return 1;
+    if (!saveHex( argv[2], &out)) return 1;
+    printf( "%-12s %8s %8s %8s\n", "", "bytes", "records", "rows");
+    printf( "%-12s %8ld %8u %8u\n", "before", in.bytes, in.records, in.rows);
+    printf( "%-12s %8ld %8u %8u\n", "after", out.bytes, out.records, out.rows);
+    printf( "saved %.1f%% bytes, %d row cycles\n",
+            100.0 * (in.bytes - out.bytes) / in.bytes, (int)in.rows - (int)out.rows);
+    return 0;
+}
@@ -0,0 +1,332 @@
+/*******************************************************************************
+Copyright 2016 Microchip Technology Inc. (www.microchip.com)
+
+ Hex Parser Benchmark (host)
+
+  Times the per-character ParseHex() of the original firmware against the
+  segment parser ParseHexBlock() of direct.c on the same hex files. Both are
+  fed 64-byte segments, as received from the MSD endpoint, and assemble rows
+  into a sink instead of the target (no ICSP), the images they produce are
+  compared. Host figures only rank the two decoders, the PIC18 cost per byte
+  is not derived from them.
+
+  Build:   cc -O2 -I. -I../../MPLAB.X -I../../MPLAB.X/system_config/XPRESS
+              -I../../framework/fileio/inc -I../../framework/usb/inc
+              -I../../bsp/xpress -o bench bench.c target.c
+              ../../MPLAB.X/direct.c ../../MPLAB.X/files.c
+              ../../MPLAB.X/lvp.c ../../MPLAB.X/lvp-200.c
+  Usage:   bench [file.hex ...]     (default ../XpressBL.hex)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "xc.h"
+#include "leds.h"
+#include "lvp.h"
+#include "usb_config.h"
+#include "direct.h"
+
+#define IMAGE_WORDS     0x80000     // 20-bit byte addresses
+#define FILE_MAX        0x100000
+#define SEGMENT         MSD_OUT_EP_SIZE
+#define MIN_TIME        0.5         // seconds per measure
+
+void LED_On( LED led) {}
+void LED_Off( LED led) {}
+
+static uint16_t image_old[ IMAGE_WORDS], image_new[ IMAGE_WORDS];
+static uint8_t  file[ FILE_MAX];
+static unsigned rows_old, rows_new;
+
+/*******************************************************************************
+ Original parser (fbbb6b3), the row is copied to a sink instead of the target
+ ******************************************************************************/
+#define OLD_ROW_SIZE    32
+#define OLD_CFG_ADDRESS 0x8000
+
+static uint16_t row[ OLD_ROW_SIZE];
+static uint32_t row_address;
+
+static void oldInit( void) {
+    memset((void*)row, 0xff, sizeof(row));
+    row_address = 0x8000;
+}
+
+static bool isDigit( char * c){
+    if (*c < '0') return false;
+    *c -= '0'; if (*c > 9) *c-=7;
+    if (*c > 0xf)  return false;
+    return true;
+}
+
+static void oldLvpWrite( void){
+    memcpy( &image_old[ row_address], row, sizeof(row));
+    rows_old++;
+}
+
+static void oldWriteRow( void) {
+    uint8_t i;
+    uint16_t chk = 0xffff;
+    for( i=0; i< OLD_ROW_SIZE; i++) chk &= row[i];  // blank check
+    if (chk != 0xffff) {
+        oldLvpWrite();
+        memset((void*)row, 0xff, sizeof(row));
+    }
+}
+
+static void oldPackRow( uint32_t address, uint8_t *data, uint8_t data_count) {
+    uint8_t  index = (address & 0x3e)>>1;
+    uint32_t new_row = (address & 0xfffc0)>>1;
+    if (new_row != row_address) {
+        oldWriteRow();
+        row_address = new_row;
+    }
+    data_count = (data_count+1) & 0xfe;
+    while ((data_count > 0) && (index < OLD_ROW_SIZE)){
+        uint16_t word = *data++;
+        word += ((uint16_t)(*data++)<<8);
+        row[index++] = word;
+        data_count -= 2;
+    }
+    if (index == OLD_ROW_SIZE) {
+        oldWriteRow();
+        if (data_count > 0) {
+            row_address += OLD_ROW_SIZE;
+            index = 0;
+            while (data_count > 0){
+                uint16_t word = *data++;
+                word += ((uint16_t)(*data++)<<8);
+                row[index++] = word;
+                data_count -= 2;
+            }
+        }
+    }
+}
+
+static void oldProgramLastRow( void) {
+    oldWriteRow();
+}
+
+enum oldstate { OLD_SOL, OLD_BYTE_COUNT, OLD_ADDRESS, OLD_RECORD_TYPE, OLD_DATA, OLD_CHKSUM};
+
+static bool ParseHex(char c)
+{
+    static enum oldstate state = OLD_SOL;
+    static uint8_t  bc;
+    static uint8_t  data_count;
+    static uint32_t address;
+    static uint32_t ext_address = 0;
+    static uint8_t  checksum;
+    static uint8_t  record_type;
+    static uint8_t  data_index, data[16];
+
+    switch( state){
+        case OLD_SOL:
+            if (c == '\r') break;
+            if (c == '\n') break;
+            if (c != ':') return false;
+            state = OLD_BYTE_COUNT;
+            bc = 0;
+            address = 0;
+            checksum = 0;
+            break;
+        case OLD_BYTE_COUNT:
+            if ( isDigit( &c) == false) { state = OLD_SOL; return false; }
+            bc++;
+            if (bc == 1)
+                data_count = c;
+            if (bc == 2 )  {
+                data_count = (data_count << 4) + c;
+                checksum += data_count;
+                bc = 0;
+                if (data_count > 16) { state = OLD_SOL; return false; }
+                state = OLD_ADDRESS;
+            }
+            break;
+        case OLD_ADDRESS:
+            if ( isDigit( &c) == false) { state = OLD_SOL; return false;}
+            bc++;
+            if (bc == 1)
+                address = c;
+            else  {
+                address = (address << 4) + (uint32_t)c;
+                if (bc == 4) {
+                    checksum += (address>>8) + address;
+                    bc = 0;
+                    state = OLD_RECORD_TYPE;
+                }
+            }
+            break;
+        case OLD_RECORD_TYPE:
+            if ( isDigit( &c) == false) { state = OLD_SOL; return false;}
+            bc++;
+            if (bc == 1)
+                if (c != 0) { state = OLD_SOL; return false; }
+            if (bc == 2)  {
+                record_type = c;
+                checksum += c;
+                bc = 0;
+                state = OLD_DATA;  // default
+                data_index = 0;
+                memset(data, 0xff, sizeof(data));
+                if (record_type == 0) break; // data record
+                if (record_type == 1) { state = OLD_CHKSUM; break; }  // EOF record
+                if (record_type == 4) break; // extended address record
+                state = OLD_SOL;
+                return false;
+            }
+            break;
+        case OLD_DATA:
+            if ( isDigit( &c) == false) { state = OLD_SOL; return false;}
+            bc++;
+            if (bc == 1)
+                data[data_index] = (c<<4);
+            if (bc == 2)  {
+                bc = 0;
+                data[data_index] += c;
+                checksum +=  data[data_index];
+                data_index++;
+                if (data_index == data_count) {
+                    state = OLD_CHKSUM;
+                }
+            }
+            break;
+        case OLD_CHKSUM:
+            if ( isDigit( &c) == false) { state = OLD_SOL; return false;}
+            bc++;
+            if (bc == 1)
+                checksum += (c<<4);
+            if (bc == 2)  {
+                bc = 0;
+                checksum += c;
+                if (checksum != 0) {
+                    state = OLD_SOL;
+                    return false;
+                }
+                state = OLD_SOL;
+                if (record_type == 0)
+                    oldPackRow( ext_address + address, data, data_count);
+                else if (record_type == 4)
+                    ext_address = ((uint32_t)(data[0]) << 24) + ((uint32_t)(data[1]) << 16);
+                else if (record_type == 1) {
+                    oldProgramLastRow();
+                    ext_address = 0;
+                }
+                else return false;
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/*******************************************************************************
+ Passes over a file, in MSD segments
+ ******************************************************************************/
+static void oldPass( uint32_t size)
+{
+    uint32_t s;
+    uint8_t *buffer, i;
+    oldInit();
+    for( s=0; s<size; s+=SEGMENT) {      // as in the original DIRECT_SectorWrite
+        buffer = &file[ s];
+        i = 0;
+        while( (i++ < SEGMENT) && ParseHex(*buffer++));
+    }
+}
+
+// the whole row is kept, as the original programmed it (unset words blank)
+static void sink( HEX_PARSER *p, DIRECT_ROW *slot, uint8_t first, uint8_t n)
+{
+    memcpy( &image_new[ slot->address], slot->data, sizeof(slot->data));
+    rows_new++;
+}
+
+static void newPass( uint32_t size)
+{
+    static HEX_PARSER p;
+    uint32_t s;
+    HEX_ParserInit( &p, sink);
+    for( s=0; s<size; s+=SEGMENT)
+        ParseHexBlock( &p, &file[ s], SEGMENT);
+    programLastRow( &p);
+}
+
+static double now( void)
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * Time passes of a decoder over the file
+ * @return  ns per byte
+ */
+static double measure( void (*pass)( uint32_t), uint32_t size, unsigned *rows)
+{
+    double t0 = now(), t;
+    unsigned n = 0;
+    do {
+        *rows = 0;
+        pass( size);
+        n++;
+    } while( (t = now() - t0) < MIN_TIME);
+    return t * 1e9 / ((double)n * size);
+}
+
+static int bench( const char *name)
+{
+    FILE *f = fopen( name, "rb");
+    uint32_t size, padded, i;
+    double t_old, t_new;
+
+    if (f == NULL) {
+        printf( "%s: cannot open\n", name);
+        return 1;
+    }
+    size = fread( file, 1, FILE_MAX - SEGMENT, f);
+    fclose( f);
+    padded = (size + SEGMENT - 1) / SEGMENT * SEGMENT;      // (sector padding)
+    memset( &file[ size], 0, padded - size);
+    memset( image_old, 0xff, sizeof(image_old));
+    memset( image_new, 0xff, sizeof(image_new));
+
+    t_old = measure( oldPass, padded, &rows_old);
+    t_new = measure( newPass, padded, &rows_new);
+    for( i=0; i<IMAGE_WORDS; i++)
+        if (image_old[ i] != image_new[ i]) break;
+
+    printf( "%s: %u bytes, %u rows\n", name, size, rows_new);
+    printf( "  ParseHex       %6.2f ns/byte\n", t_old);
+    printf( "  ParseHexBlock  %6.2f ns/byte  (%.2fx)\n", t_new, t_old / t_new);
+    if (i < IMAGE_WORDS) {
+        printf( "  images differ at word %05X\n", i);
+        return 1;
+    }
+    return 0;
+}
+
+int main( int argc, char **argv)
+{
+    int i, errors = 0;
+    if (argc < 2) return bench( "../XpressBL.hex");
+    for( i=1; i<argc; i++) errors += bench( argv[ i]);
+    return errors;
+}
@@ -0,0 +1,1115 @@
+/*******************************************************************************
+Copyright 2016 Microchip Technology Inc. (www.microchip.com)
+
+ Programmer Model (host)
+
+  Runs the programmer firmware (direct.c, files.c, lvp.c and lvp-200.c) on
+  the host against a pin level model of the ICSP target (see target.c). The
+  host side writes images to the drive the way operating systems do: FAT12
+  chains and root entries before or after the data, fragmented files, macOS
+  metadata files, sectors out of order. Time advances with the USB transfers
+  and with the waits of the firmware, the main loop (DIRECT_Tasks) and the
+  USB frame tick (DIRECT_Tick) run in between. Each scenario checks the
+  target contents, the ICSP timing and the programming statistics, the
+  figures quoted in the change history come from these scenarios.
+
+  Build:   cc -O2 -I. -I../../MPLAB.X -I../../MPLAB.X/system_config/XPRESS
+              -I../../framework/fileio/inc -I../../framework/usb/inc
+              -I../../bsp/xpress -o model model.c target.c
+              ../../MPLAB.X/direct.c ../../MPLAB.X/files.c
+              ../../MPLAB.X/lvp.c ../../MPLAB.X/lvp-200.c
+           (firmware build options are passed with -D, e.g. the hold buffer
+           scenario needs -DDIRECT_HOLD_SECTORS=1)
+  Usage:   model [scenario]
+           the exit status is the number of checks failed
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "xc.h"
+#include "target.h"
+#include "leds.h"
+#include "lvp.h"
+#include "usb_config.h"
+#include "direct.h"
+#include "files.h"
+
+#define MS              (TARGET_CYCLES_US * 1000ull)
+#define SECTOR_TIME     (TARGET_CYCLES_US * 700ull)   // host: a sector every 0.7ms at best
+#define LOOP_TIME       (TARGET_CYCLES_US * 10ull)    // main loop pass (idle)
+#define SECTOR_SIZE     FILEIO_CONFIG_MEDIA_SECTOR_SIZE
+#define SEGMENTS        (SECTOR_SIZE / MSD_OUT_EP_SIZE)
+#define CLUSTERS        (2 + DRV_FILEIO_INTERNAL_FLASH_CONFIG_DRIVE_CAPACITY)
+#define BLANK           0x3FFF
+#define FLASH_WORDS     0x8000
+#define TEXT_SIZE       0x20000
+
+extern HEX_PARSER parser;       // direct.c
+
+void LED_On( LED led) {}
+void LED_Off( LED led) {}
+
+/*******************************************************************************
+ Checks
+ ******************************************************************************/
+static int failures;
+
+static void check( bool ok, const char *fmt, ...)
+{
+    va_list ap;
+    printf( "  %s ", ok ? "ok  " : "FAIL");
+    va_start( ap, fmt);
+    vprintf( fmt, ap);
+    va_end( ap);
+    printf( "\n");
+    if (!ok) failures++;
+}
+
+/*******************************************************************************
+ Time: the USB host delivers a sector at best every SECTOR_TIME, the firmware
+ runs its main loop in between (and for as long as it blocks the host)
+ ******************************************************************************/
+static uint64_t host_time, tick_time;
+
+static void ticks( void)        // USB start of frame, every ms
+{
+    while (tick_time + MS <= target_now) {
+        tick_time += MS;
+        DIRECT_Tick();
+    }
+}
+
+static void service( uint64_t until)
+{
+    do {
+        ticks();
+        DIRECT_Tasks();
+        if (target_now < until) target_now += LOOP_TIME;
+    } while (target_now < until);
+    ticks();
+}
+
+static void idle( uint32_t ms)
+{
+    service( target_now + ms * MS);
+}
+
+/**
+ * Wait for the session to close and the target to be released
+ */
+static void sessionWait( void)
+{
+    uint32_t n;
+    for( n=0; n<10000; n++) {
+        idle( 1);
+        if (!parser.session && !parser.corrupt && !DIRECT_ProgrammingInProgress()) break;
+    }
+}
+
+static void sectorWrite( uint32_t lba, const uint8_t *data)
+{
+    uint8_t seg, buf[ MSD_OUT_EP_SIZE];
+    service( host_time);
+    for( seg=0; seg<SEGMENTS; seg++) {
+        memcpy( buf, &data[ seg * MSD_OUT_EP_SIZE], MSD_OUT_EP_SIZE);
+        DIRECT_SectorWrite( NULL, lba, buf, seg);
+        ticks();
+    }
+    host_time = ((host_time > target_now) ? host_time : target_now) + SECTOR_TIME;
+}
+
+static void sectorRead( uint32_t lba, uint8_t *data)
+{
+    uint8_t seg;
+    service( host_time);
+    for( seg=0; seg<SEGMENTS; seg++) {
+        memset( &data[ seg * MSD_IN_EP_SIZE], 0, MSD_IN_EP_SIZE);
+        if (!DIRECT_SegmentBlank( NULL, lba, seg))
+            DIRECT_SectorRead( NULL, lba, &data[ seg * MSD_IN_EP_SIZE], seg);
+        ticks();
+    }
+    host_time = ((host_time > target_now) ? host_time : target_now) + SECTOR_TIME;
+}
+
+/*******************************************************************************
+ Host FAT12 volume: the FAT and root sectors are read once (mount) and written
+ back whole, files are allocated from the first free cluster
+ ******************************************************************************/
+static uint8_t fat[ SECTOR_SIZE], root[ SECTOR_SIZE];
+
+enum copyflags {
+    COPY_META_FIRST = 0,        // FAT and root entry before the data
+    COPY_DATA_FIRST = 1,        // data before the FAT and root entry
+    COPY_FRAGMENT   = 2,        // every other cluster
+    COPY_SWAP       = 4,        // data sectors swapped pairwise
+    COPY_APPLE      = 8,        // macOS "._" metadata file
+    COPY_DIRECTORY  = 16,       // and a sub-directory
+    COPY_KEEP       = 32,       // do not wait for the end of the session
+    COPY_REWRITE    = 64        // first sector written again halfway
+};
+
+static uint16_t fatGet( uint16_t n)
+{
+    uint16_t b = n * 3 / 2, v = fat[ b] | (fat[ b+1] << 8);
+    return (n & 1) ? (v >> 4) : (v & 0xFFF);
+}
+
+static void fatSet( uint16_t n, uint16_t v)
+{
+    uint16_t b = n * 3 / 2;
+    if (n & 1) {
+        fat[ b] = (fat[ b] & 0x0F) | (uint8_t)(v << 4);
+        fat[ b+1] = (uint8_t)(v >> 4);
+    }
+    else {
+        fat[ b] = (uint8_t)v;
+        fat[ b+1] = (fat[ b+1] & 0xF0) | ((v >> 8) & 0x0F);
+    }
+}
+
+static void mount( void)
+{
+    sectorRead( 2, fat);
+    sectorRead( 3, root);
+}
+
+static void metaWrite( void)
+{
+    sectorWrite( 2, fat);
+    sectorWrite( 3, root);
+}
+
+/**
+ * Delete every file written by the host (the next copy reuses the clusters)
+ */
+static void volumeClear( void)
+{
+    uint16_t c, e;
+    for( e=0; e<ROOT_ENTRIES; e++) {
+        uint8_t *d = &root[ e * ROOT_ENTRY_SIZE];
+        c = d[ ENTRY_CLUSTER] | (d[ ENTRY_CLUSTER+1] << 8);
+        if ((d[0] == 0) || (d[0] == ENTRY_DELETED)) continue;
+        if ((d[ ENTRY_ATTRIBUTES] & ATTR_VOLUME) || (c == README_CLUSTER) || (c >= HOST_CLUSTERS))
+            continue;           // (entries of the drive)
+        d[0] = ENTRY_DELETED;
+    }
+    for( c=README_CLUSTER + 1; c<HOST_CLUSTERS; c++) fatSet( c, 0);
+    metaWrite();
+}
+
+static uint8_t entryAlloc( void)
+{
+    uint8_t e;
+    for( e=0; e<ROOT_ENTRIES; e++)
+        if ((root[ e * ROOT_ENTRY_SIZE] == 0) || (root[ e * ROOT_ENTRY_SIZE] == ENTRY_DELETED))
+            return e;
+    return 0xFF;
+}
+
+static void entrySet( uint8_t e, const char *name, uint8_t attr, uint16_t cluster, uint32_t size)
+{
+    uint8_t *d = &root[ e * ROOT_ENTRY_SIZE];
+    memset( d, 0, ROOT_ENTRY_SIZE);
+    memcpy( d, name, 11);
+    d[ ENTRY_ATTRIBUTES] = attr;
+    d[ ENTRY_CLUSTER] = (uint8_t)cluster;
+    d[ ENTRY_CLUSTER+1] = (uint8_t)(cluster >> 8);
+    memcpy( &d[ ENTRY_FILE_SIZE_OFFSET], &size, 4);
+}
+
+/**
+ * Allocate a cluster chain
+ * @return  number of clusters (0 = volume full)
+ */
+static uint16_t chainAlloc( uint16_t *chain, uint32_t size, bool fragment)
+{
+    uint16_t n = 0, c, count = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (count == 0) count = 1;
+    for( c=README_CLUSTER + 1; (c < HOST_CLUSTERS) && (n < count); c++) {
+        if (fatGet( c) != 0) continue;
+        chain[ n++] = c;
+        if (fragment) c++;      // (leave a hole)
+    }
+    if (n < count) return 0;
+    for( c=0; c<n; c++) fatSet( chain[ c], (c + 1 < n) ? chain[ c+1] : 0xFFF);
+    return n;
+}
+
+static void dataWrite( const uint16_t *chain, uint16_t n, const uint8_t *data, uint32_t size, uint8_t flags)
+{
+    uint8_t sector[ SECTOR_SIZE];
+    uint16_t i, k, r = (flags & COPY_REWRITE) ? n / 2 : n;
+    for( i=0; i<n; i++) {
+        k = ((flags & COPY_SWAP) && ((i ^ 1) < n)) ? (i ^ 1) : i;
+        if (i == r) {           // (again, after the sectors following it)
+            r = n;
+            k = 0;
+            i--;
+        }
+        memset( sector, 0, SECTOR_SIZE);
+        if (k * SECTOR_SIZE < size)
+            memcpy( sector, &data[ k * SECTOR_SIZE],
+                    (size - k * SECTOR_SIZE < SECTOR_SIZE) ? size - k * SECTOR_SIZE : SECTOR_SIZE);
+        sectorWrite( CLUSTER_SECTOR( chain[ k]), sector);
+    }
+}
+
+// contents of the metadata files, a hex record that would corrupt word 0
+static const char bogus[] = ":020000000000FE\r\n:00000001FF\r\n";
+
+/**
+ * Copy a file to the drive
+ * @param name  8.3 name, space padded (11 characters)
+ * @return  ms from the first sector to the end of the session
+ */
+static uint32_t copy( const char *name, const void *data, uint32_t size, uint8_t flags)
+{
+    static uint16_t chain[ CLUSTERS], extra[ 2];
+    uint64_t t = target_now;
+    uint16_t n;
+    uint8_t e, a = 0xFF, d = 0xFF;
+
+    e = entryAlloc();
+    n = chainAlloc( chain, size, flags & COPY_FRAGMENT);
+    if ((e == 0xFF) || (n == 0)) {
+        check( false, "%.11s does not fit the volume", name);
+        return 0;
+    }
+    entrySet( e, name, 0x20, chain[0], size);
+    if (flags & COPY_APPLE) {   // long name "._xxx" + short name entry
+        uint8_t *lfn;
+        a = entryAlloc() + 1;
+        lfn = &root[ (a - 1) * ROOT_ENTRY_SIZE];
+        memset( lfn, 0, ROOT_ENTRY_SIZE);
+        lfn[0] = 0x41; lfn[1] = '.'; lfn[3] = '_'; lfn[5] = name[0];
+        lfn[ ENTRY_ATTRIBUTES] = ATTR_LFN;
+        chainAlloc( &extra[0], sizeof(bogus), false);
+        entrySet( a, "_IMAGE~1HEX", 0x20, extra[0], sizeof(bogus));
+    }
+    if (flags & COPY_DIRECTORY) {
+        d = entryAlloc();
+        chainAlloc( &extra[1], sizeof(bogus), false);
+        entrySet( d, "SUBDIR     ", ATTR_DIRECTORY, extra[1], 0);
+    }
+    if (!(flags & COPY_DATA_FIRST)) metaWrite();
+    dataWrite( chain, n, data, size, flags);
+    if (a != 0xFF) dataWrite( &extra[0], 1, (const uint8_t*)bogus, sizeof(bogus), 0);
+    if (d != 0xFF) dataWrite( &extra[1], 1, (const uint8_t*)bogus, sizeof(bogus), 0);
+    metaWrite();                // (size and date updated on close)
+    if (!(flags & COPY_KEEP)) sessionWait();
+    return (uint32_t)((target_now - t) / MS);
+}
+
+/*******************************************************************************
+ Images: the expected program memory and config words, written out as hex
+ (XC8 style records or hexopt style rows), raw binary or compressed images
+ ******************************************************************************/
+static uint16_t image[ FLASH_WORDS];
+static uint16_t config[ TARGET_CFG_MAX];
+static uint8_t  text[ TEXT_SIZE];
+static uint32_t seed;
+
+static uint16_t rnd( void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static void imageBlank( void)
+{
+    uint16_t i;
+    for( i=0; i<FLASH_WORDS; i++) image[ i] = BLANK;
+    for( i=0; i<TARGET_CFG_MAX; i++) config[ i] = BLANK;
+}
+
+/**
+ * Code with a blank gap (alignment, unused vectors) every ~gaps words
+ */
+static void imageCode( uint32_t s, uint16_t from, uint16_t words, uint16_t gaps)
+{
+    uint16_t a = from, gap;
+    seed = s;
+    while( a < from + words) {
+        if ((rnd() % gaps) == 0) {
+            for( gap = rnd() % 24; (gap > 0) && (a < from + words); gap--) a++;
+            continue;
+        }
+        image[ a++] = rnd() % BLANK;    // (never blank)
+    }
+}
+
+/**
+ * Code with occasional blank gaps
+ */
+static void imageFill( uint32_t s, uint16_t from, uint16_t words)
+{
+    imageCode( s, from, words, 16);
+}
+
+static void configSet( void)
+{
+    static const uint16_t words[ TARGET_CFG_MAX] = { 0x3FEC, 0x3FFF, 0x3F9F, 0x3FFF, 0x3FFF};
+    memcpy( config, words, sizeof(config));
+}
+
+enum hexflags {
+    HEX_SHUFFLE = 1,            // records in random order
+    HEX_ROWS    = 2,            // hexopt: ascending records of at most a row
+    HEX_CORRUPT = 4             // checksum error in the middle of the file
+};
+
+#define CFG_END     (TARGET_CFG_WORD + TARGET_CFG_MAX)
+
+static uint16_t wordAt( uint32_t a)
+{
+    if (a < FLASH_WORDS) return image[ a];
+    if ((a >= TARGET_CFG_WORD) && (a < CFG_END)) return config[ a - TARGET_CFG_WORD];
+    return BLANK;
+}
+
+typedef struct { uint32_t address; uint8_t n; } RECORD;
+static RECORD records[ FLASH_WORDS];
+
+static char *hexLine( char *s, uint8_t n, uint16_t address, uint8_t type, const uint8_t *data)
+{
+    uint8_t sum = n + (address >> 8) + address + type, i;
+    s += sprintf( s, ":%02X%04X%02X", n, address, type);
+    for( i=0; i<n; i++) {
+        s += sprintf( s, "%02X", data[ i]);
+        sum += data[ i];
+    }
+    return s + sprintf( s, "%02X\r\n", (uint8_t)(0 - sum));
+}
+
+/**
+ * Write the image as an INTEL hex file
+ * @param bytes     data bytes per record (aligned), rows split at 64 (HEX_ROWS)
+ * @return  size of the file in text
+ */
+static uint32_t hexWrite( uint8_t bytes, uint8_t flags)
+{
+    uint32_t a, end, r, nr = 0, i;
+    uint16_t ext = 0;
+    uint8_t data[ 255], k;
+    char *s = (char*)text;
+
+    // runs of non blank words, split at the record boundaries
+    for( a=0; a<CFG_END; ) {
+        if (wordAt( a) == BLANK) { a++; continue; }
+        for( end = a + 1; (end < CFG_END) && (wordAt( end) != BLANK); end++)
+            if (((end * 2) % bytes) == 0) break;    // record boundary
+        records[ nr].address = a;
+        records[ nr++].n = (end - a) * 2;
+        a = end;
+    }
+    if (flags & HEX_SHUFFLE) {
+        for( i=nr - 1; i>0; i--) {
+            RECORD t;
+            r = rnd() % (i + 1);
+            t = records[ i]; records[ i] = records[ r]; records[ r] = t;
+        }
+    }
+    for( i=0; i<nr; i++) {
+        a = records[ i].address;
+        if ((a >> 15) != ext) {         // byte address above 64K
+            ext = a >> 15;
+            data[0] = 0; data[1] = ext;
+            s = hexLine( s, 2, 0, 4, data);
+        }
+        for( k=0; k<records[ i].n / 2; k++) {
+            uint16_t w = wordAt( a + k);
+            data[ 2*k] = (uint8_t)w;
+            data[ 2*k + 1] = (uint8_t)(w >> 8);
+        }
+        s = hexLine( s, records[ i].n, (uint16_t)(a << 1), 0, data);
+        if ((flags & HEX_CORRUPT) && (i == nr / 2)) s[ -3] ^= 0x01;  // checksum digit
+    }
+    s = hexLine( s, 0, 0, 1, data);
+    return (uint32_t)(s - (char*)text);
+}
+
+/**
+ * Split the image in records of at most a row, full rows in one record
+ */
+static uint32_t hexRows( void)
+{
+    return hexWrite( ROW_BYTES, 0);
+}
+
+static uint32_t binWrite( uint16_t words)
+{
+    uint16_t a;
+    for( a=0; a<words; a++) {
+        text[ 2*a] = (uint8_t)image[ a];
+        text[ 2*a + 1] = (uint8_t)(image[ a] >> 8);
+    }
+    return words * 2;
+}
+
+static uint32_t xpzWrite( void)
+{
+    uint8_t *s = text;
+    uint32_t a = 0, n, i;
+    *s++ = 'X'; *s++ = 'P'; *s++ = 'Z'; *s++ = 1;
+    while( a < FLASH_WORDS) {
+        for( n=0; (a + n < FLASH_WORDS) && (image[ a + n] == BLANK); n++);
+        if (a + n >= FLASH_WORDS) break;
+        if (n > 64) { *s++ = 0xC1; *s++ = (uint8_t)n; *s++ = (uint8_t)(n >> 8); }
+        else if (n > 0) *s++ = 0x40 + n - 1;
+        a += n;
+        for( n=0; (n < 64) && (a + n < FLASH_WORDS) && (image[ a + n] != BLANK); n++);
+        *s++ = n - 1;           // literal run
+        for( i=0; i<n; i++, a++) { *s++ = (uint8_t)image[ a]; *s++ = (uint8_t)(image[ a] >> 8); }
+    }
+    if (config[0] != BLANK) {
+        *s++ = 0xC0; *s++ = 0x07; *s++ = 0x80;
+        *s++ = TARGET_CFG_MAX - 1;
+        for( i=0; i<TARGET_CFG_MAX; i++) { *s++ = (uint8_t)config[ i]; *s++ = (uint8_t)(config[ i] >> 8); }
+    }
+    *s++ = 0xFF;
+    return (uint32_t)(s - text);
+}
+
+/*******************************************************************************
+ Target
+ ******************************************************************************/
+static const TARGET_DEVICE *device;
+static TARGET_STATS ts;         // target statistics (since the last targetCheck)
+
+/**
+ * Compare the target with the image and check the protocol
+ */
+static bool targetMatch( void)
+{
+    uint32_t a;
+    uint16_t w, e;
+    uint8_t i;
+    for( a=0; a<device->flash_size; a++) {
+        if ((w = target_word( a)) != image[ a]) {
+            printf( "       word %04X: %04X instead of %04X\n", (unsigned)a, w, image[ a]);
+            return false;
+        }
+    }
+    for( i=0; i<device->cfg_num; i++) {
+        e = (config[ i] | ~device->cfg_mask[ i]) & BLANK;
+        if ((w = target_word( TARGET_CFG_WORD + i)) != e) {
+            printf( "       config %d: %04X instead of %04X\n", i + 1, w, e);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void targetCheck( const char *what)
+{
+    target_stats( &ts, true);
+    check( targetMatch(), "%s: target matches the image", what);
+    check( (ts.violations == 0) && (ts.overwrites == 0) && (ts.cfg_overwrites == 0),
+           "%s: %u rows, %u commands, no timing violation or overwrite (%u, %u, %u)", what,
+           ts.rows, ts.commands, ts.violations, ts.overwrites, ts.cfg_overwrites);
+}
+
+/**
+ * Power up the programmer with a blank target (drive mounted)
+ */
+static void powerUp( const TARGET_DEVICE *d)
+{
+    device = d;
+    target_select( d);
+    DIRECT_Initialize();
+    LVP_calibrationReset();
+    host_time = tick_time = target_now;
+    mount();
+    volumeClear();
+    imageBlank();
+}
+
+/**
+ * S1 pressed (the programmer forgets the previous image)
+ */
+static void reset( void)
+{
+    DIRECT_Initialize();
+    LVP_calibrationReset();
+}
+
+static DIRECT_STATISTICS st;    // statistics at the start of a step
+
+static void statsMark( void)
+{
+    st = *DIRECT_StatisticsGet();
+}
+
+#define DELTA( f)   (DIRECT_StatisticsGet()->f - st.f)
+
+/*******************************************************************************
+ Scenarios
+ ******************************************************************************/
+static void imageA( void)
+{
+    imageBlank();
+    imageFill( 1, 0x0000, 0x0700);      // 56 rows + config (replay record)
+    configSet();
+}
+
+static void program( void)
+{
+    uint32_t n, ms;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 7, 0x0000, 0x1000);
+    configSet();
+    n = hexWrite( 16, 0);
+    statsMark();
+    ms = copy( "IMAGE   HEX", text, n, COPY_META_FIRST);
+    printf( "  %u bytes of hex programmed in %u ms (with %u ms of quiet time)\n",
+            n, ms, DIRECT_SESSION_QUIET);
+    targetCheck( "program");
+    check( DELTA( verifyErrors) == 0 && DELTA( rowsVerified) > 0, "program: %u rows verified", DELTA( rowsVerified));
+    printf( "  commands %u\n", DIRECT_StatisticsGet()->commands);
+}
+
+static void replay( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18855);
+    imageA();
+    n = hexWrite( 16, 0);
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "first copy");
+    // the same file again
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    target_stats( &ts, false);
+    check( (DELTA( replays) == 1) && (ts.entries == 0),
+           "replay: identical copy dropped (%u entries)", ts.entries);
+    targetCheck( "replay");
+    // change the last rows
+    image[ 0x06F0] ^= 0x0101;
+    image[ 0x06FF] = 0x0123;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    check( DELTA( patches) == 1, "patch: applied as a patch (%u rows skipped)", DELTA( rowsSkipped));
+    targetCheck( "patch");
+    // truncated image
+    imageA();
+    for( n=0x400; n<0x700; n++) image[ n] = BLANK;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "truncated patch");
+    // config bit cleared (WDTE), then set again
+    config[ 2] = 0x3F8F;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    target_stats( &ts, false);
+    check( (DELTA( patches) == 1) && (DELTA( replayErrors) == 0) && (ts.bulk_erases == 0),
+           "patch: config bit cleared (%u rows skipped)", DELTA( rowsSkipped));
+    targetCheck( "config patch");
+    config[ 2] = 0x3F9F;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    target_stats( &ts, true);
+    check( (DELTA( replayErrors) == 1) && (ts.bulk_erases == 1) && (target_word( 0) == BLANK),
+           "patch: config bit to set, target erased and image aborted");
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "copied again");
+    // an image longer than the record tags (rows past them are compared)
+    imageBlank();
+    imageFill( 4, 0x0000, 0x1800);      // 192 rows
+    configSet();
+    n = hexWrite( 16, 0);
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "long image");
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    target_stats( &ts, false);
+    check( (DELTA( replays) == 1) && (ts.rows == 0) && (ts.row_erases == 0) && (ts.bulk_erases == 0),
+           "replay: identical long copy dropped (%u rows compared)", DELTA( rowsSkipped) - DIRECT_REPLAY_ROWS);
+    targetCheck( "long replay");
+    image[ 0x1234] ^= 0x0100;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    check( DELTA( patches) == 1, "patch: past the tags (%u rows skipped)", DELTA( rowsSkipped));
+    targetCheck( "long patch");
+}
+
+static void differential( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18855);
+    imageBlank();
+    imageFill( 2, 0x0000, 0x1000);
+    configSet();
+    n = hexWrite( 16, 0);
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "first copy");
+    // S1, then a changed image: a row in the middle, shorter and config
+    reset();
+    image[ 0x0800] ^= 0x1000;
+    for( n=0x0E00; n<0x1000; n++) image[ n] = BLANK;
+    config[ 0] = 0x3F8C;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    check( DELTA( diffs) == 1, "diff: programmed differentially (%u rows skipped)", DELTA( rowsSkipped));
+    targetCheck( "diff");
+    // S1, config bits cleared: an implemented one (FEXTOSC) and one that is 
+    // not implemented (reads 1 whatever the hex file says)
+    reset();
+    config[ 0] = 0x3F84;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    target_stats( &ts, false);
+    check( (DELTA( diffs) == 1) && (DELTA( replayErrors) == 0) && (ts.bulk_erases == 0),
+           "diff: config bits cleared without a bulk erase");
+    targetCheck( "diff, config cleared");
+    // S1, the implemented bit set again: bulk erase, the image is aborted
+    reset();
+    config[ 0] = 0x3F8D;
+    n = hexWrite( 16, 0);
+    statsMark();
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    target_stats( &ts, true);
+    check( (DELTA( replayErrors) == 1) && (ts.bulk_erases == 1) && (target_word( 0) == BLANK),
+           "diff: config bit to set, target erased and image aborted");
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "copied again");
+}
+
+static void shuffled( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 3, 0x0000, 0x0C00);
+    configSet();
+    seed = 99;
+    n = hexWrite( 16, HEX_SHUFFLE);
+    statsMark();
+    copy( "IMAGE   HEX", text, n, 0);
+    printf( "  cache misses %u, hits %u\n", DELTA( cacheMisses), DELTA( cacheHits));
+    targetCheck( "shuffled records");
+}
+
+static void dataFirst( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 4, 0x0000, 0x0C00);
+    configSet();
+    n = hexWrite( 16, 0);
+    copy( "IMAGE   HEX", text, n, COPY_DATA_FIRST);
+    targetCheck( "data before FAT");
+}
+
+static void fragmented( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 5, 0x0000, 0x0C00);
+    configSet();
+    n = hexWrite( 16, 0);
+    statsMark();
+    copy( "IMAGE   HEX", text, n, COPY_FRAGMENT | COPY_APPLE | COPY_DIRECTORY);
+    check( DELTA( sectorsSkipped) >= 2, "fragmented: %u metadata sectors skipped", DELTA( sectorsSkipped));
+    targetCheck( "fragmented");
+}
+
+static void order( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 6, 0x0000, 0x0C00);
+    configSet();
+    n = hexWrite( 16, 0);
+    statsMark();
+    copy( "IMAGE   HEX", text, n, COPY_SWAP);
+    check( DELTA( sectorsEarly) > 0, "swapped: %u sectors early", DELTA( sectorsEarly));
+#if (DIRECT_HOLD_SECTORS > 0)
+    targetCheck( "swapped, held");
+#else
+    target_stats( &ts, true);
+    check( !targetMatch(), "swapped: image rejected");
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "in order copy");
+#endif
+    imageFill( 7, 0x0000, 0x0C00);
+    n = hexWrite( 16, 0);
+    volumeClear();
+    statsMark();
+    copy( "IMAGE   HEX", text, n, COPY_REWRITE);
+    check( (DELTA( sectorsSkipped) == 1) && (DELTA( recordErrors) == 0),
+           "rewritten: sector skipped (%u)", DELTA( sectorsSkipped));
+    targetCheck( "rewritten");
+}
+
+static void corrupt( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 8, 0x0000, 0x0C00);
+    configSet();
+    n = hexWrite( 16, HEX_CORRUPT);
+    statsMark();
+    copy( "IMAGE   HEX", text, n, 0);
+    target_stats( &ts, true);
+    check( (DELTA( recordErrors) == 1) && !targetMatch(), "corrupt record: session aborted");
+    n = hexWrite( 16, 0);
+    volumeClear();
+    copy( "IMAGE   HEX", text, n, 0);
+    targetCheck( "next copy");
+}
+
+static void batch( void)
+{
+    static uint8_t boot[ TEXT_SIZE];
+    uint32_t nb, n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 9, 0x0000, 0x0200);      // bootloader
+    configSet();
+    nb = hexWrite( 16, 0);
+    memcpy( boot, text, nb);
+    imageBlank();
+    imageFill( 10, 0x0200, 0x0A00);     // application
+    n = hexWrite( 16, 0);
+    imageFill( 9, 0x0000, 0x0200);
+    configSet();
+    copy( "BOOT    HEX", boot, nb, COPY_KEEP);
+    copy( "APP     HEX", text, n, 0);
+    target_stats( &ts, false);
+    check( (ts.entries == 1) && (ts.bulk_erases == 1), "batch: one session (%u entries, %u bulk erases)",
+           ts.entries, ts.bulk_erases);
+    targetCheck( "batch");
+}
+
+static void binary( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 11, 0x0000, 0x0800);
+    n = binWrite( 0x0900);
+    copy( "IMAGE   BIN", text, n, 0);
+    targetCheck( "bin");
+}
+
+static void compressed( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 12, 0x0000, 0x0800);
+    imageFill( 13, 0x1800, 0x0100);
+    configSet();
+    n = xpzWrite();
+    copy( "IMAGE   XPZ", text, n, 0);
+    targetCheck( "xpz");
+}
+
+static void bitError( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 14, 0x0000, 0x0400);
+    configSet();
+    n = hexWrite( 16, 0);
+    target_faultRead( 0x0123, 0x0004);
+    statsMark();
+    copy( "IMAGE   HEX", text, n, 0);
+    check( DELTA( verifyErrors) == 1, "bit error: %u row failed verification", DELTA( verifyErrors));
+    target_faultRead( 0xFFFF, 0);
+}
+
+static void reportRead( char *s)
+{
+    uint8_t sector[ SECTOR_SIZE];
+    sectorRead( CLUSTER_SECTOR( VERIFY_CLUSTER), sector);
+    memcpy( s, sector, 4 * VERIFY_LINE);
+    s[ 4 * VERIFY_LINE] = 0;
+}
+
+static void verifyOnly( void)
+{
+    char report[ 4 * VERIFY_LINE + 1];
+    uint32_t n, program;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 15, 0x0000, 0x1000);
+    configSet();
+    n = hexWrite( 16, 0);
+    copy( "IMAGE   HEX", text, n, 0);
+    program = DIRECT_StatisticsGet()->commands;
+    targetCheck( "program");
+    volumeClear();
+    copy( "VERIFY  TXT", "", 0, COPY_KEEP);
+    copy( "IMAGE   HEX", text, n, 0);
+    reportRead( report);
+    target_stats( &ts, true);
+    check( strstr( report, "PASS") && (ts.rows == 0) && (ts.bulk_erases == 0),
+           "verify-only: PASS, %u commands (%u to program)", DIRECT_StatisticsGet()->commands, program);
+    image[ 0x0421] ^= 0x0040;
+    n = hexWrite( 16, 0);
+    volumeClear();
+    copy( "VERIFY  TXT", "", 0, COPY_KEEP);
+    copy( "IMAGE   HEX", text, n, 0);
+    reportRead( report);
+    check( strstr( report, "FAIL") && strstr( report, "mismatch     1"), "verify-only: FAIL, 1 row");
+}
+
+#if DIRECT_READBACK
+static void readback( void)
+{
+    static uint8_t hex[ CLUSTERS * SECTOR_SIZE];
+    uint32_t c, a, errors = 0, words = 0;
+    char *s;
+    uint16_t ext = 0;
+    powerUp( &target_pic16f18855);
+    imageBlank();
+    imageFill( 16, 0x0000, 0x1800);
+    configSet();
+    copy( "IMAGE   HEX", text, hexWrite( 16, 0), 0);
+    for( c=READBACK_HEX_CLUSTER; c<CLUSTERS; c++)
+        sectorRead( CLUSTER_SECTOR( c), &hex[ (c - READBACK_HEX_CLUSTER) * SECTOR_SIZE]);
+    // READ.HEX
+    hex[ READBACK_HEX_SIZE] = 0;
+    for( s = (char*)hex; (s = strchr( s, ':')) != NULL; s++) {
+        unsigned n, address, type, i, lo, hi;
+        sscanf( s, ":%2x%4x%2x", &n, &address, &type);
+        if (type == 4) { sscanf( s + 9, "%4x", &c); ext = c; continue; }
+        if (type != 0) continue;
+        for( i=0; i<n/2; i++) {
+            sscanf( s + 9 + 4*i, "%2x%2x", &lo, &hi);
+            a = (((uint32_t)ext << 16) + address) / 2 + i;
+            if (((lo | (hi << 8)) & BLANK) != target_word( a)) errors++;
+            words++;
+        }
+    }
+    // FLASH.BIN
+    for( a=0; a<DIRECT_READBACK_WORDS; a++) {
+        uint8_t *b = &hex[ (READBACK_BIN_CLUSTER - READBACK_HEX_CLUSTER) * SECTOR_SIZE + 2*a];
+        if (((b[0] | (b[1] << 8)) & BLANK) != target_word( a)) errors++;
+    }
+    check( errors == 0, "readback: READ.HEX (%u words) and FLASH.BIN match the target", words);
+    idle( DIRECT_READBACK_QUIET + 10);
+    check( !LVP_inProgress(), "readback: target released");
+}
+#else
+/**
+ * No readback files: the volume is left to the host up to the FAT chains 
+ * tracked, VERIFY.TXT takes the last cluster
+ */
+static void readback( void)
+{
+    uint16_t c, free = 0, bad = 0;
+    powerUp( &target_pic16f18855);
+    for( c=README_CLUSTER + 1; c<VERIFY_CLUSTER; c++) {
+        if (fatGet( c) == 0) free++;
+        else if (fatGet( c) == 0xFF7) bad++;
+    }
+    check( (free == HOST_CLUSTERS - README_CLUSTER - 1) && (free + bad + 4 == CLUSTERS)
+           && (fatGet( VERIFY_CLUSTER) == 0xFFF) && !memcmp( &root[ 2 * ROOT_ENTRY_SIZE], "VERIFY  TXT", 11),
+           "readback: off, %u clusters left to the host (%u not tracked)", free, bad);
+}
+#endif
+
+static void blankSegments( void)
+{
+    uint8_t seg, buf[ MSD_IN_EP_SIZE], i;
+    uint32_t lba, blank = 0, total = 0, wrong = 0;
+    powerUp( &target_pic16f18877);
+    for( lba=0; lba<DRV_FILEIO_INTERNAL_FLASH_TOTAL_DISK_SIZE; lba++) {
+        for( seg=0; seg<SEGMENTS; seg++, total++) {
+            if (!DIRECT_SegmentBlank( NULL, lba, seg)) continue;
+            blank++;
+            memset( buf, 0xAA, sizeof(buf));
+            DIRECT_SectorRead( NULL, lba, buf, seg);
+            for( i=0; i<MSD_IN_EP_SIZE; i++)
+                if (buf[ i]) { wrong++; break; }
+        }
+    }
+    idle( DIRECT_READBACK_QUIET + 10);
+    check( wrong == 0, "blank segments: %u of %u, none reads non zero", blank, total);
+}
+
+/**
+ * 256 rows and the config words at the LVP level, internally and externally
+ * timed
+ */
+static void timing( void)
+{
+    uint16_t row[ 32], r, i;
+    uint64_t t0, t1;
+    bool ext;
+    for( ext = false; ; ext = true) {
+        powerUp( &target_pic16f18877);
+        imageFill( 17, 0x0000, 0x2000);
+        for( r=0; r<0x2000; r++) if (image[ r] == BLANK) image[ r] = 0x0000;
+        configSet();
+        LVP_externalTimingSet( ext);
+        LVP_enter();
+        t0 = target_now;
+        LVP_bulkErase();
+        for( r=0; r<256; r++) {
+            for( i=0; i<32; i++) row[ i] = image[ r*32 + i];
+            LVP_addressLoad( r * 32);
+            LVP_rowWrite( row, 32);
+        }
+        LVP_wait();
+        t1 = target_now;
+        LVP_cfgWrite( config, TARGET_CFG_MAX);
+        LVP_exit();
+        printf( "  %s timing: bulk erase + 256 rows in %u ms\n", ext ? "external" : "internal",
+                (unsigned)((t1 - t0) / MS));
+        targetCheck( ext ? "external timing" : "internal timing");
+        if (ext) break;
+    }
+    LVP_externalTimingSet( LVP_EXTERNAL_TIMING);
+}
+
+static void calibrate( void)
+{
+    uint32_t n;
+    const LVP_CALIBRATION *cal;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageFill( 18, 0x0000, 0x0400);
+    configSet();
+    n = hexWrite( 16, 0);
+    copy( "IMAGE   HEX", text, n, 0);
+    cal = LVP_calibrationGet();
+    check( cal->valid && (cal->speed == LVP_SPEED_DEFAULT) && (cal->retries == 0),
+           "calibration: stops at the default speed (%u)", cal->speed);
+    targetCheck( "calibrated at the default speed");
+    reset();
+    target_faultSpeed( LVP_SPEED_SAFE);     // reads fail above the safe speed
+    copy( "IMAGE   HEX", text, n, 0);
+    check( cal->valid && (cal->speed == LVP_SPEED_SAFE) && (cal->retries > 0),
+           "calibration: safe speed kept (%u retries)", cal->retries);
+    targetCheck( "calibrated");
+}
+
+static void family6( void)
+{
+    uint32_t n;
+    powerUp( &target_pic16f1459);
+    imageBlank();
+    imageFill( 19, 0x0000, 0x0800);
+    config[0] = 0x3FE4;
+    config[1] = 0x3FFF;
+    n = hexWrite( 16, 0);
+    statsMark();
+    copy( "IMAGE   HEX", text, n, 0);
+    check( LVP_calibrationGet()->family == LVP_FAMILY_6BIT, "6-bit: protocol detected");
+    check( (LVP_deviceGet()->id == 0x3023) && (LVP_deviceGet()->row_size == 32),
+           "6-bit: PIC16F1459 found in the device table");
+    targetCheck( "6-bit");
+    check( (DELTA( verifyErrors) == 0) && (DELTA( rowsVerified) == ts.rows),
+           "6-bit: %u rows verified in batches", DELTA( rowsVerified));
+    // the readbacks held back still catch an error
+    imageFill( 20, 0x0000, 0x0800);
+    n = hexWrite( 16, 0);
+    target_faultRead( 0x0123, 0x0004);
+    statsMark();
+    copy( "IMAGE   HEX", text, n, 0);
+    check( DELTA( verifyErrors) == 1, "6-bit: %u row failed verification", DELTA( verifyErrors));
+    target_faultRead( 0xFFFF, 0);
+}
+
+/**
+ * hexopt style image: ascending records of at most a row
+ */
+static void stream( void)
+{
+    uint32_t n, ms;
+    powerUp( &target_pic16f18877);
+    imageBlank();
+    imageCode( 20, 0x0000, 0x3000, 160);
+    configSet();
+    n = hexRows();
+    statsMark();
+    ms = copy( "IMAGE   HEX", text, n, 0);
+    printf( "  %u rows programmed, %u full-row records, cache misses %u, queue full %u, queue high %u\n",
+            DELTA( rowsVerified), DELTA( fastRows), DELTA( cacheMisses), DELTA( queueFull),
+            DIRECT_StatisticsGet()->queueHigh);
+    printf( "  %u bytes of hex programmed in %u ms (with %u ms of quiet time)\n",
+            n, ms, DIRECT_SESSION_QUIET);
+    targetCheck( "stream");
+}
+
+static const struct {
+    const char *name;
+    void (*run)( void);
+} scenarios[] = {
+    { "program",    program},
+    { "replay",     replay},
+    { "diff",       differential},
+    { "shuffled",   shuffled},
+    { "datafirst",  dataFirst},
+    { "fragmented", fragmented},
+    { "order",      order},
+    { "corrupt",    corrupt},
+    { "batch",      batch},
+    { "bin",        binary},
+    { "xpz",        compressed},
+    { "biterror",   bitError},
+    { "verify",     verifyOnly},
+    { "readback",   readback},
+    { "blank",      blankSegments},
+    { "timing",     timing},
+    { "calibrate",  calibrate},
+    { "6bit",       family6},
+    { "stream",     stream},
+};
+
+int main( int argc, char **argv)
+{
+    uint8_t i;
+    for( i=0; i<sizeof(scenarios)/sizeof(scenarios[0]); i++) {
+        if ((argc > 1) && strcmp( argv[1], scenarios[ i].name)) continue;
+        printf( "%s\n", scenarios[ i].name);
+        scenarios[ i].run();
+    }
+    printf( "%d check(s) failed\n", failures);
+    return failures;
+}
@@ -0,0 +1,384 @@
+/*******************************************************************************
+Copyright 2016 Microchip Technology Inc. (www.microchip.com)
+
+ ICSP Target Model (host)
+
+  A PIC16F1 target at the pin level, driven by the port accesses of lvp.c and
+  lvp-200.c (see xc.h): key sequence, 8-bit (250K) and 6-bit (200K) command
+  sets, write latches, program memory and config space. Programming can only
+  clear bits (a word latched with a 1 where it holds a 0 is counted as an
+  overwrite, blank latches leave the word as it is) and every cycle keeps the target busy for its datasheet maximum:
+  a command received earlier, or an externally timed pulse outside of the
+  TPEXT window, is counted as a violation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*******************************************************************************/
+
+#include <string.h>
+#include "xc.h"
+#include "target.h"
+#include "lvp.h"
+
+#define PIN_CLK         0x04    // RB2
+#define PIN_DAT         0x08    // RB3
+#define PIN_nMCLR       0x10    // RB4 (1 = target held in reset)
+#define KEY             0x4D434850ul    // "MCHP"
+#define BLANK           0x3FFF
+#define US( t)          ((uint64_t)(t) * TARGET_CYCLES_US)
+
+const TARGET_DEVICE target_pic16f18855 = {
+    "PIC16F18855", 8, 0x306C, 0x2002, 32, 0x2000, 5,
+    { 0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}, true,
+    2800, 5600, 8400, 2800, 1000, 2100, 300
+};
+
+const TARGET_DEVICE target_pic16f18877 = {
+    "PIC16F18877", 8, 0x3076, 0x2002, 32, 0x8000, 5,
+    { 0x2977, 0x3EE3, 0x3F7F, 0x2803, 0x0003}, true,
+    2800, 5600, 8400, 2800, 1000, 2100, 300
+};
+
+const TARGET_DEVICE target_pic16f1459 = {
+    "PIC16F1459", 6, 0x3023, 0x1005, 32, 0x2000, 2,
+    { 0x3EFF, 0x3FF3}, true,
+    2500, 5000, 5000, 2500, 1000, 2100, 300
+};
+
+MODEL_LATB  model_latb;
+MODEL_TRISB model_trisb = { 0xff };
+MODEL_PORTB model_portb;
+MODEL_PIR1  model_pir1;
+uint8_t     model_t1con, model_tmr1h, model_tmr1l;
+uint64_t    target_now;
+
+enum phase { IDLE, KEYING, DUMMY, COMMAND, PAYLOAD, OUTPUT};
+
+static const TARGET_DEVICE *dev = &target_pic16f18877;
+static TARGET_STATS stats;
+static uint16_t flash[ 0x8000];
+static uint16_t cfg[ 0x20];             // config space
+static uint16_t latch[ 64];
+static uint64_t latched;                // latches loaded (bit per latch)
+static uint16_t pc;
+static uint8_t  phase = IDLE;
+static uint8_t  cmd, bits;
+static uint32_t shift;
+static uint64_t start;                  // first bit of the command
+static uint64_t busy_until, ext_start;
+static bool     ext_pending;
+static uint8_t  pins;                   // last levels seen
+static bool     timer_on;
+static uint64_t timer_end;
+static uint16_t fault_address = 0xffff, fault_flip;
+static uint8_t  fault_speed = 0xff;
+
+void target_select( const TARGET_DEVICE *d)
+{
+    uint16_t i;
+    dev = d;
+    for( i=0; i<0x8000; i++) flash[ i] = BLANK;
+    for( i=0; i<0x20; i++) cfg[ i] = BLANK;
+    cfg[ 5] = d->rev;
+    cfg[ 6] = d->id;
+    phase = IDLE;
+    busy_until = 0;
+    ext_pending = false;
+    fault_address = 0xffff;
+    fault_speed = 0xff;
+    memset( &stats, 0, sizeof(stats));
+}
+
+void target_stats( TARGET_STATS *s, bool clear)
+{
+    if (s) *s = stats;
+    if (clear) memset( &stats, 0, sizeof(stats));
+}
+
+void target_faultRead( uint16_t address, uint16_t flip)
+{
+    fault_address = address;
+    fault_flip = flip;
+}
+
+void target_faultSpeed( uint8_t speed)
+{
+    fault_speed = speed;
+}
+
+uint16_t target_word( uint16_t address)
+{
+    uint8_t i;
+    if (address < TARGET_CFG_SPACE)
+        return (address < dev->flash_size) ? flash[ address] : 0;
+    address -= TARGET_CFG_SPACE;
+    if (address >= 0x20) return 0;
+    i = address - (TARGET_CFG_WORD - TARGET_CFG_SPACE);
+    if ((address >= 7) && (i < dev->cfg_num))
+        return cfg[ address] | (BLANK & ~dev->cfg_mask[ i]);   // unimplemented read 1
+    return cfg[ address];
+}
+
+static uint16_t readWord( void)
+{
+    uint16_t w = target_word( pc);
+    stats.reads++;
+    if (pc == fault_address) w ^= fault_flip;
+    if (LVP_speedGet() > fault_speed) w ^= 0x0010;
+    return w;
+}
+
+static void increment( void)
+{
+    if (dev->family == 8)
+        pc++;
+    else    // (6-bit: the PC stays in its memory space)
+        pc = (pc & TARGET_CFG_SPACE) | ((pc + 1) & 0x7fff);
+}
+
+static void busy( uint16_t us)
+{
+    busy_until = target_now + US( us);
+}
+
+static void program( void)
+{
+    uint16_t base, mask = BLANK, *cell;
+    uint8_t i, k = pc & 0x1f;
+
+    if (pc >= TARGET_CFG_SPACE) {       // one word
+        i = pc & (dev->row_size - 1);
+        cell = &cfg[ k];
+        if ((k >= 7) && (k - 7 < dev->cfg_num)) mask = dev->cfg_mask[ k - 7];
+        if ((latch[ i] != BLANK) && (latch[ i] & ~*cell & mask)) stats.cfg_overwrites++;
+        if ((k != 5) && (k != 6)) *cell &= latch[ i];     // (IDs are read-only)
+        stats.cfg_writes++;
+        busy( dev->tpcfg);
+    }
+    else {
+        base = pc & ~(dev->row_size - 1);
+        for( i=0; i<dev->row_size; i++) {
+            if ((latched & (1ull << i)) == 0) continue;
+            cell = &flash[ (base + i) & 0x7fff];
+            if ((latch[ i] != BLANK) && (latch[ i] & ~*cell)) stats.overwrites++;
+            *cell &= latch[ i];
+        }
+        stats.rows++;
+        busy( dev->tpint);
+    }
+    for( i=0; i<dev->row_size; i++) latch[ i] = BLANK;
+    latched = 0;
+}
+
+static void load( uint16_t w)
+{
+    uint8_t i = pc & (dev->row_size - 1);
+    latch[ i] = w & BLANK;
+    latched |= 1ull << i;
+    stats.latches++;
+}
+
+static void bulkErase( void)
+{
+    uint16_t i;
+    for( i=0; i<0x8000; i++) flash[ i] = BLANK;
+    if (pc >= TARGET_CFG_SPACE)         // user IDs and config words too
+        for( i=0; i<0x20; i++)
+            if ((i != 5) && (i != 6)) cfg[ i] = BLANK;
+    stats.bulk_erases++;
+    busy( dev->terab);
+}
+
+static void rowErase( void)
+{
+    uint16_t i, base = pc & ~(dev->row_size - 1);
+    if (!dev->row_erase) return;
+    if (pc < TARGET_CFG_SPACE)
+        for( i=0; i<dev->row_size; i++) flash[ (base + i) & 0x7fff] = BLANK;
+    stats.row_erases++;
+    busy( dev->terar);
+}
+
+/**
+ * Start the output of a word (read command)
+ */
+static void output( uint16_t w)
+{
+    shift = (uint32_t)(w & BLANK) << 1;     // start and stop bits
+    bits = (dev->family == 8) ? 24 : 16;
+    phase = OUTPUT;
+}
+
+/**
+ * A command has been received (8-bit and 6-bit command sets)
+ */
+static void execute( void)
+{
+    stats.commands++;
+    if (start < busy_until) stats.violations++;    // cycle still running
+    if (ext_pending && (cmd != ((dev->family == 8) ? 0x82 : 0x0A))) {
+        stats.violations++;                         // end of pulse missing
+        ext_pending = false;
+    }
+    phase = COMMAND;
+    bits = 0;
+    shift = 0;
+    if (dev->family == 8) {
+        switch( cmd) {
+            case 0x80: case 0x00: case 0x02:    phase = PAYLOAD; break;
+            case 0xF8:  pc++; break;
+            case 0xFC:  output( readWord()); break;
+            case 0xFE:  output( readWord()); pc++; break;
+            case 0xE0:  program(); break;
+            case 0xC0:  program(); busy_until = 0; ext_pending = true; ext_start = start; break;
+            case 0x82:  break;
+            case 0x18:  bulkErase(); break;
+            case 0xF0:  rowErase(); break;
+            default:    break;
+        }
+    }
+    else {
+        switch( cmd) {
+            case 0x00: case 0x02:   phase = PAYLOAD; break;
+            case 0x06:  increment(); break;
+            case 0x16:  pc = 0; break;
+            case 0x04:  output( readWord()); break;
+            case 0x08:  program(); break;
+            case 0x18:  program(); busy_until = 0; ext_pending = true; ext_start = start; break;
+            case 0x0A:  break;
+            case 0x09:  bulkErase(); break;
+            case 0x11:  rowErase(); break;
+            default:    break;
+        }
+    }
+    if ((cmd == 0x82) || ((dev->family == 6) && (cmd == 0x0A))) {   // end of pulse
+        if (!ext_pending || (start < ext_start + US( dev->tpext_min)) ||
+                (start > ext_start + US( dev->tpext_max)))
+            stats.violations++;
+        ext_pending = false;
+        busy( dev->tdis);
+    }
+}
+
+/**
+ * Payload of a command received
+ */
+static void payload( void)
+{
+    uint16_t w;
+    if (dev->family == 8) {
+        w = (uint16_t)(shift >> 1);
+        if (cmd == 0x80) pc = w;
+        else {
+            load( w);
+            if (cmd == 0x02) pc++;
+        }
+    }
+    else {
+        w = (shift >> 1) & BLANK;
+        if (cmd == 0x00) pc = TARGET_CFG_SPACE;
+        load( w);
+    }
+    phase = COMMAND;
+    bits = 0;
+    shift = 0;
+}
+
+/**
+ * Clock falling edge with DAT driven by the programmer
+ */
+static void latchBit( uint8_t b)
+{
+    switch( phase) {
+        case KEYING:    // Msb first (8-bit) or Lsb first (6-bit)
+            if (dev->family == 8) shift = (shift << 1) | b;
+            else shift = (shift >> 1) | ((uint32_t)b << 31);
+            if (shift != KEY) return;
+            stats.entries++;
+            pc = 0;
+            bits = 0;
+            shift = 0;
+            phase = (dev->family == 8) ? COMMAND : DUMMY;
+            return;
+        case DUMMY:     // 33rd clock of the 6-bit key
+            phase = COMMAND;
+            return;
+        case COMMAND:
+            if (bits == 0) start = target_now;
+            if (dev->family == 8) shift = (shift << 1) | b;
+            else shift |= (uint32_t)b << bits;
+            if (++bits < ((dev->family == 8) ? 8 : 6)) return;
+            cmd = (uint8_t)shift;
+            execute();
+            return;
+        case PAYLOAD:
+            if (dev->family == 8) shift = (shift << 1) | b;
+            else shift |= (uint32_t)b << bits;
+            if (++bits < ((dev->family == 8) ? 24 : 16)) return;
+            payload();
+            return;
+        default:
+            return;
+    }
+}
+
+/**
+ * Clock rising edge, the target drives DAT when reading
+ */
+static void outputBit( void)
+{
+    uint8_t b;
+    if (phase != OUTPUT) return;
+    bits--;
+    if (dev->family == 8) b = (shift >> bits) & 1;      // Msb first
+    else b = (shift >> (15 - bits)) & 1;                // Lsb first
+    model_portb.reg = b ? PIN_DAT : 0;
+    if (bits == 0) {
+        phase = COMMAND;
+        shift = 0;
+    }
+}
+
+void model_sync( void)
+{
+    uint8_t now = model_latb.reg, on = model_t1con & 1;
+
+    if (on && !timer_on)        // Timer1 started (Fosc/4, 1:8)
+        timer_end = target_now + 8ull * (0x10000 - ((model_tmr1h << 8) | model_tmr1l));
+    timer_on = on;
+
+    if ((now ^ pins) & PIN_nMCLR) {     // reset, wait for the key
+        phase = (now & PIN_nMCLR) ? KEYING : IDLE;
+        shift = 0;
+        bits = 0;
+        ext_pending = false;
+        model_portb.reg = 0;
+    }
+    if ((now & PIN_CLK) && !(pins & PIN_CLK))
+        outputBit();
+    if (!(now & PIN_CLK) && (pins & PIN_CLK) && !(model_trisb.reg & PIN_DAT))
+        latchBit( (now & PIN_DAT) ? 1 : 0);
+    pins = now;
+}
+
+void model_timer( void)
+{
+    model_delay( 4);            // (one poll)
+    if (timer_on && (target_now >= timer_end)) model_pir1.TMR1IF = 1;
+}
+
+void model_delay( uint32_t cycles)
+{
+    model_sync();
+    target_now += cycles;
+}
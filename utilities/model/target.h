@@ -0,0 +1,78 @@
+/*******************************************************************************
+Copyright 2016 Microchip Technology Inc. (www.microchip.com)
+
+ ICSP Target Model (see target.c)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*******************************************************************************/
+
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TARGET_CYCLES_US    12      // model time unit: instruction cycles (12MHz)
+#define TARGET_CFG_SPACE    0x8000
+#define TARGET_CFG_WORD     0x8007  // first config word
+#define TARGET_CFG_MAX      5
+
+// device answering the ICSP commands (datasheet values, timing in us)
+typedef struct {
+    const char *name;
+    uint8_t  family;            // protocol: 8 (250K) or 6 (200K) bit commands
+    uint16_t id;                // device ID (0x8006)
+    uint16_t rev;               // revision ID (0x8005)
+    uint8_t  row_size;          // write latches
+    uint16_t flash_size;        // program memory (words)
+    uint8_t  cfg_num;           // config words
+    uint16_t cfg_mask[ TARGET_CFG_MAX];    // implemented bits (others read 1)
+    bool     row_erase;         // row erase command implemented
+    uint16_t tpint;             // maximums of the internally timed cycles
+    uint16_t tpcfg;
+    uint16_t terab;
+    uint16_t terar;
+    uint16_t tpext_min;         // externally timed programming window
+    uint16_t tpext_max;
+    uint16_t tdis;
+} TARGET_DEVICE;
+
+extern const TARGET_DEVICE target_pic16f18855;
+extern const TARGET_DEVICE target_pic16f18877;
+extern const TARGET_DEVICE target_pic16f1459;
+
+// what the target went through (since target_select)
+typedef struct {
+    uint32_t commands;          // commands decoded
+    uint32_t latches;           // latches loaded
+    uint32_t reads;             // words read
+    uint16_t entries;           // key sequences accepted
+    uint16_t rows;              // program memory rows programmed (cycles)
+    uint16_t cfg_writes;        // config space words programmed
+    uint16_t row_erases;
+    uint16_t bulk_erases;
+    uint16_t overwrites;        // program words with a 0 bit to set (not erased)
+    uint16_t cfg_overwrites;    // config words with a 0 bit to set (not erased)
+    uint16_t violations;        // commands sent too early or out of the TPEXT window
+} TARGET_STATS;
+
+extern uint64_t target_now;     // model time (instruction cycles)
+
+void target_select( const TARGET_DEVICE *dev);    // power up, blank device
+uint16_t target_word( uint16_t address);        // as read by the programmer
+void target_stats( TARGET_STATS *s, bool clear);
+void target_faultRead( uint16_t address, uint16_t flip);  // corrupt a word read
+void target_faultSpeed( uint8_t speed);         // corrupt the reads above a speed
+
+#endif  /* TARGET_H */
@@ -0,0 +1,76 @@
+/*******************************************************************************
+Copyright 2016 Microchip Technology Inc. (www.microchip.com)
+
+ Host stand-in for the XC8 <xc.h> (see model.c)
+
+  The registers used by lvp.c and lvp-200.c are routed to the ICSP target
+  model: every port access first lets the target see the pin levels (clock
+  edges, nMCLR), the delays advance the model time (in instruction cycles,
+  12MHz) and Timer1 sets its flag once the time it was loaded with is over
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*******************************************************************************/
+
+#ifndef MODEL_XC_H
+#define MODEL_XC_H
+
+#include <stdint.h>
+
+typedef union {
+    uint8_t reg;
+    struct { unsigned LATB0:1, LATB1:1, LATB2:1, LATB3:1, LATB4:1, LATB5:1, LATB6:1, LATB7:1; };
+} MODEL_LATB;
+
+typedef union {
+    uint8_t reg;
+    struct { unsigned TRISB0:1, TRISB1:1, TRISB2:1, TRISB3:1, TRISB4:1, TRISB5:1, TRISB6:1, TRISB7:1; };
+} MODEL_TRISB;
+
+typedef union {
+    uint8_t reg;
+    struct { unsigned RB0:1, RB1:1, RB2:1, RB3:1, RB4:1, RB5:1, RB6:1, RB7:1; };
+} MODEL_PORTB;
+
+typedef union {
+    uint8_t reg;
+    struct { unsigned TMR1IF:1, TMR2IF:1, CCP1IF:1, SSPIF:1, TXIF:1, RCIF:1, ADIF:1, PSPIF:1; };
+} MODEL_PIR1;
+
+extern MODEL_LATB  model_latb;
+extern MODEL_TRISB model_trisb;
+extern MODEL_PORTB model_portb;
+extern MODEL_PIR1  model_pir1;
+extern uint8_t     model_t1con, model_tmr1h, model_tmr1l;
+
+void model_sync( void);                 // target sees the pins
+void model_timer( void);                // Timer1 flag polled
+void model_delay( uint32_t cycles);     // busy wait
+
+#define LATB            (*(model_sync(), &model_latb.reg))
+#define LATBbits        (*(model_sync(), &model_latb))
+#define TRISB           (*(model_sync(), &model_trisb.reg))
+#define TRISBbits       (*(model_sync(), &model_trisb))
+#define PORTB           (*(model_sync(), &model_portb.reg))
+#define PORTBbits       (*(model_sync(), &model_portb))
+#define T1CON           (*(model_sync(), &model_t1con))
+#define TMR1H           model_tmr1h
+#define TMR1L           model_tmr1l
+#define PIR1bits        (*(model_timer(), &model_pir1))
+
+#define NOP()           model_delay( 1)
+#define _delay( n)      model_delay( n)
+#define __delay_us( x)  model_delay( (x) * 12ul)
+#define __delay_ms( x)  model_delay( (x) * 12000ul)
+
+#endif  /* MODEL_XC_H */
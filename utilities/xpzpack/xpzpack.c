@@ -0,0 +1,227 @@
+/*******************************************************************************
+Copyright 2016 Microchip Technology Inc. (www.microchip.com)
+
+ XPZ Image Packer (host utility)
+
+  Converts an INTEL Hex file produced by the MPLAB XC8 compiler into the
+  compressed (.XPZ) image format decoded on the fly by the XPRESS programmer
+  (see direct.c). Erased words are dropped (blank runs) and repeated patterns
+  are replaced by references into a small history window.
+
+  Build:   cc -O2 -o xpzpack xpzpack.c
+  Usage:   xpzpack input.hex output.xpz
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define XPZ_VERSION     1
+#define XPZ_LITERAL     0x00
+#define XPZ_BLANK       0x40
+#define XPZ_MATCH       0x80
+#define XPZ_ADDRESS     0xC0
+#define XPZ_SKIP        0xC1
+#define XPZ_END         0xFF
+
+#define WINDOW          32      // must match DIRECT_XPZ_WINDOW in the firmware
+#define MAX_RUN         64      // literal/blank run per token
+#define MAX_MATCH       65      // words per match token
+#define MIN_MATCH       2
+#define MEM_WORDS       0x10000 // 16-bit word address space
+#define BLANK_WORD      0x3FFF  // erased (14-bit) program word
+
+static uint16_t image[ MEM_WORDS];
+static bool     present[ MEM_WORDS];
+
+static uint8_t  *out;
+static size_t   out_len, out_size;
+
+static uint16_t history[ MEM_WORDS];  // words entering the decoder window
+static size_t   hist_len;
+
+static void emit( uint8_t b)
+{
+    if (out_len == out_size) {
+        out_size = out_size ? out_size * 2 : 4096;
+        out = realloc( out, out_size);
+        if (out == NULL) { fprintf( stderr, "out of memory\n"); exit( 1); }
+    }
+    out[ out_len++] = b;
+}
+
+static int hexByte( const char *s)
+{
+    int v;
+    if (sscanf( s, "%2x", &v) != 1) return -1;
+    return v;
+}
+
+/**
+ * Load an INTEL Hex file in the word image
+ * @return  number of input bytes or -1 on error
+ */
+static long loadHex( const char *name)
+{
+    FILE *f = fopen( name, "r");
+    char line[ 600];
+    uint32_t ext = 0;
+    long size = 0;
+    int  n, i, type, b;
+    uint32_t addr;
+    uint8_t sum;
+
+    if (f == NULL) { perror( name); return -1; }
+    while (fgets( line, sizeof(line), f)) {
+        size += strlen( line);
+        if (line[0] != ':') continue;
+        n = hexByte( &line[1]);
+        addr = (hexByte( &line[3]) << 8) + hexByte( &line[5]);
+        type = hexByte( &line[7]);
+        if ((n < 0) || (type < 0)) { fprintf( stderr, "invalid record: %s", line); fclose( f); return -1; }
+        sum = n + (addr >> 8) + addr + type;
+        for (i = 0; i <= n; i++) {
+            b = hexByte( &line[ 9 + 2*i]);
+            if (b < 0) { fprintf( stderr, "invalid record: %s", line); fclose( f); return -1; }
+            sum += b;
+            if ((i < n) && (type == 0)) {
+                uint32_t a = ext + addr + i;
+                if ((a >> 1) >= MEM_WORDS) continue;
+                if (!present[ a >> 1]) image[ a >> 1] = 0xFFFF;
+                present[ a >> 1] = true;
+                if (a & 1) image[ a >> 1] = (image[ a >> 1] & 0x00FF) | (b << 8);
+                else       image[ a >> 1] = (image[ a >> 1] & 0xFF00) | b;
+            }
+            if ((i < n) && (type == 4))
+                ext = (i == 0) ? ((uint32_t)b << 24) : (ext | ((uint32_t)b << 16));
+        }
+        if (sum != 0) { fprintf( stderr, "checksum error: %s", line); fclose( f); return -1; }
+        if (type == 1) break;
+    }
+    fclose( f);
+    return size;
+}
+
+static bool isBlank( uint32_t a)
+{
+    return !present[ a] || ((image[ a] & BLANK_WORD) == BLANK_WORD);
+}
+
+/**
+ * Find the longest match for the words starting at a (within a run of n)
+ * in the decoder window, matches may overlap the words being produced
+ */
+static int findMatch( uint32_t a, int n, int *distance)
+{
+    int d, k, best = 0;
+    for (d = 1; (d <= WINDOW) && ((size_t)d <= hist_len); d++) {
+        for (k = 0; (k < n) && (k < MAX_MATCH); k++) {
+            uint16_t w = (k < d) ? history[ hist_len - d + k] : image[ a + k - d];
+            if (w != image[ a + k]) break;
+        }
+        if (k > best) { best = k; *distance = d; }
+    }
+    return best;
+}
+
+static void flushLiterals( uint32_t a, int n)
+{
+    if (n == 0) return;
+    emit( XPZ_LITERAL | (n - 1));
+    while (n-- > 0) {
+        emit( image[ a] & 0xFF);
+        emit( image[ a] >> 8);
+        a++;
+    }
+}
+
+static void pack( void)
+{
+    uint32_t a = 0, next = 0;   // next = address the decoder will write next
+    uint32_t lit_start = 0;
+    int lit = 0;
+
+    emit( 'X'); emit( 'P'); emit( 'Z'); emit( XPZ_VERSION);
+    while (a < MEM_WORDS) {
+        uint32_t e, gap;
+        int n, len, dist = 0;
+
+        if (isBlank( a)) { a++; continue; }
+        // a is the start of a run of non-blank words, bring the decoder here
+        gap = a - next;
+        if (gap > 0) {
+            if (gap <= MAX_RUN) emit( XPZ_BLANK | (gap - 1));
+            else if (gap <= 0xFFFF) { emit( XPZ_SKIP); emit( gap & 0xFF); emit( gap >> 8); }
+            else { emit( XPZ_ADDRESS); emit( a & 0xFF); emit( a >> 8); }
+        }
+        for (e = a; (e < MEM_WORDS) && !isBlank( e); e++);
+        n = e - a;
+        lit_start = a;
+        lit = 0;
+        while (n > 0) {
+            len = findMatch( a, n, &dist);
+            if (len >= MIN_MATCH) {
+                flushLiterals( lit_start, lit);
+                emit( XPZ_MATCH | (len - MIN_MATCH));
+                emit( dist - 1);
+                while (len-- > 0) { history[ hist_len++] = image[ a++]; n--; }
+                lit_start = a;
+                lit = 0;
+            }
+            else {
+                history[ hist_len++] = image[ a];
+                lit++; a++; n--;
+                if (lit == MAX_RUN) { flushLiterals( lit_start, lit); lit_start = a; lit = 0; }
+            }
+        }
+        flushLiterals( lit_start, lit);
+        next = e;
+        a = e;
+    }
+    emit( XPZ_END);
+}
+
+int main( int argc, char *argv[])
+{
+    FILE *f;
+    long in_size;
+    uint32_t a, words = 0, rows = 0;
+
+    if (argc != 3) {
+        fprintf( stderr, "usage: %s input.hex output.xpz\n", argv[0]);
+        return 1;
+    }
+    in_size = loadHex( argv[1]);
+    if (in_size < 0) return 1;
+    pack();
+    f = fopen( argv[2], "wb");
+    if ((f == NULL) || (fwrite( out, 1, out_len, f) != out_len)) { perror( argv[2]); return 1; }
+    fclose( f);
+    for (a = 0; a < MEM_WORDS; a++) {
+        if (!isBlank( a)) words++;
+        if (((a & 31) == 0)) {
+            uint32_t i;
+            for (i = a; (i < a + 32) && isBlank( i); i++);
+            if (i < a + 32) rows++;
+        }
+    }
+    printf( "%s: %ld bytes hex, %u words in %u rows -> %s: %lu bytes (%.1f%%)\n",
+            argv[1], in_size, words, rows, argv[2], (unsigned long)out_len,
+            100.0 * out_len / in_size);
+    return 0;
+}